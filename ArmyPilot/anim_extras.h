@@ -0,0 +1,264 @@
+// ----------------------------------------------------------------------------
+// Animation helper functions
+//-----------------------------------------------------------------------------
+
+#include <algorithm>
+
+// ----------------------------------------------------------------------------
+// Root motion extracted from the root (hip) channel of a clip.
+// The track holds the ground-plane displacement of the root from tick 0, one
+// sample per tick, in the parent space of the root node. Subtracting it from
+// the sampled root position gives the in-place pose; the same displacement
+// (converted to model space) drives the character's world position.
+struct rootMotion
+{
+	int channel;              //Index of the root channel in the clip (-1 if none)
+	int nTicks;               //Number of samples in the track (duration + 1)
+	aiVector3D* track;        //Per-tick ground-plane displacement (parent space of root node)
+	aiMatrix3x3 toModel;      //Parent space of the root node -> model space
+	aiVector3D velocity;      //Fallback displacement per tick (model space) for in-place clips
+	bool inPlace;             //True if the clip itself does not travel
+};
+
+// ----------------------------------------------------------------------------
+// Linear interpolation of a channel's position keys at the given tick
+aiVector3D samplePositionKeys(const aiNodeAnim* channel, double tick)
+{
+	const aiVectorKey* keys = channel->mPositionKeys;
+	int nkeys = channel->mNumPositionKeys;
+
+	if (nkeys == 1 || tick <= keys[0].mTime) return keys[0].mValue;
+	for (int k = 1; k < nkeys; k++)
+	{
+		if (tick <= keys[k].mTime)
+		{
+			float factor = (tick - keys[k-1].mTime) / (keys[k].mTime - keys[k-1].mTime);
+			return keys[k-1].mValue + factor * (keys[k].mValue - keys[k-1].mValue);
+		}
+	}
+	return keys[nkeys-1].mValue;
+}
+
+// ----------------------------------------------------------------------------
+// Returns the index of the channel animating the node closest to the root of
+// the hierarchy, or -1 if none of the channels target a node in the tree.
+int findRootChannel(const aiAnimation* anim, const aiNode* rootNode)
+{
+	int best = -1, bestDepth = 1 << 30;
+	for (int i = 0; i < anim->mNumChannels; i++)
+	{
+		const aiNode* nd = rootNode->FindNode(anim->mChannels[i]->mNodeName);
+		if (nd == NULL) continue;
+		int depth = 0;
+		for (const aiNode* p = nd->mParent; p != NULL; p = p->mParent) depth++;
+		if (depth < bestDepth)
+		{
+			best = i;
+			bestDepth = depth;
+		}
+	}
+	return best;
+}
+
+// ----------------------------------------------------------------------------
+// Builds the root motion track of a clip. "up" is the model-space up axis; only
+// the displacement perpendicular to it is extracted, so the hips keep their
+// vertical bob. Nodes named "ignoredNode" are skipped when accumulating the
+// parent transformation (as done by transformVertices() of the Mannequin).
+// Clips whose root does not travel over a cycle (less than 5% of the root's
+// distance from the origin) are treated as in-place, and are moved by "velocity"
+// per tick instead.
+void extractRootMotion(rootMotion* rm, assetArena* arena, const aiAnimation* anim, const aiNode* rootNode,
+	aiVector3D up, aiVector3D velocity, const char* ignoredNode = NULL)
+{
+	rm->channel = findRootChannel(anim, rootNode);
+	rm->nTicks = (int)anim->mDuration + 1;
+	rm->track = arenaAlloc<aiVector3D>(arena, ARENA_CLIPS, rm->nTicks);
+	rm->velocity = velocity;
+	rm->inPlace = true;
+	up.Normalize();
+
+	if (rm->channel < 0)
+	{
+		for (int t = 0; t < rm->nTicks; t++) rm->track[t] = aiVector3D(0, 0, 0);
+		return;
+	}
+
+	const aiNodeAnim* channel = anim->mChannels[rm->channel];
+	const aiNode* nd = rootNode->FindNode(channel->mNodeName);
+	aiMatrix4x4 parent;
+	for (const aiNode* p = nd->mParent; p != NULL; p = p->mParent)
+	{
+		if (ignoredNode == NULL || p->mName != aiString(ignoredNode))
+			parent = p->mTransformation * parent;
+	}
+	rm->toModel = aiMatrix3x3(parent);
+	aiMatrix3x3 toParent = rm->toModel;
+	toParent.Inverse();
+
+	aiVector3D start = samplePositionKeys(channel, 0);
+	float meanDist = 0;
+	for (int t = 0; t < rm->nTicks; t++)
+	{
+		aiVector3D posn = samplePositionKeys(channel, t);
+		aiVector3D disp = rm->toModel * (posn - start);
+		disp -= (disp * up) * up;           //Remove the vertical component
+		rm->track[t] = toParent * disp;
+		meanDist += (rm->toModel * posn).Length() / rm->nTicks;
+	}
+
+	aiVector3D cycle = rm->toModel * rm->track[rm->nTicks - 1];
+	rm->inPlace = (cycle.Length() < 0.05f * meanDist);
+	if (rm->inPlace)
+	{
+		for (int t = 0; t < rm->nTicks; t++) rm->track[t] = aiVector3D(0, 0, 0);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Displacement to subtract from the sampled root position (parent space of the root)
+aiVector3D rootMotionLocal(const rootMotion* rm, int tick)
+{
+	if (tick < 0) tick = 0;
+	if (tick >= rm->nTicks) tick = rm->nTicks - 1;
+	return rm->track[tick];
+}
+
+// ----------------------------------------------------------------------------
+// Model-space displacement of the character at the given tick, relative to tick 0.
+// Cheap enough to advance many characters without sampling their skeletons.
+aiVector3D rootMotionOffset(const rootMotion* rm, int tick)
+{
+	if (rm->inPlace) return rm->velocity * (float)tick;
+	return rm->toModel * rootMotionLocal(rm, tick);
+}
+
+// ----------------------------------------------------------------------------
+// Model-space displacement over one complete cycle of the clip
+aiVector3D rootMotionCycle(const rootMotion* rm)
+{
+	return rootMotionOffset(rm, rm->nTicks - 1);
+}
+
+// ----------------------------------------------------------------------------
+// Load-time clip analysis. Position and rotation tracks whose keys are all
+// (nearly) equal are read from their first key, channels whose node is not
+// in the skeleton are dropped, and channels with a constant local
+// transformation are written only when the clip becomes active. Only the
+// remaining "animated" channels are sampled every tick.
+struct clipInfo
+{
+	const aiAnimation* anim;
+	int nChannels;
+	aiNodeAnim** posnChannel;     //Channel supplying the position keys (itself, unless retargeted)
+	int* node;                    //Skeleton index of the animated node (-1 if not in the skeleton)
+	bool* constPosn;              //Position track is constant
+	bool* constRotn;              //Rotation track is constant
+
+	int nBound, nAnimated;
+	int* bound;                   //Channels bound to a node: evaluated when the clip becomes active
+	int* animated;                //Bound channels with at least one varying track: evaluated every tick
+};
+
+// ----------------------------------------------------------------------------
+bool isConstantPosition(const aiNodeAnim* channel, float tolerance)
+{
+	aiVector3D p0 = channel->mPositionKeys[0].mValue;
+	float eps = tolerance * aisgl_max(1.0f, p0.Length());
+	for (int k = 1; k < channel->mNumPositionKeys; k++)
+		if ((channel->mPositionKeys[k].mValue - p0).Length() > eps) return false;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+bool isConstantRotation(const aiNodeAnim* channel, float tolerance)
+{
+	aiQuaternion q0 = channel->mRotationKeys[0].mValue;
+	for (int k = 1; k < channel->mNumRotationKeys; k++)
+	{
+		aiQuaternion q = channel->mRotationKeys[k].mValue;
+		float dot = q0.w * q.w + q0.x * q.x + q0.y * q.y + q0.z * q.z;
+		if (1.0f - fabs(dot) > tolerance) return false;     //q and -q are the same rotation
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// "channelNode" gives the skeleton node of each channel (NULL: all channels are bound).
+// "posnChannels" gives the channel supplying the position keys (NULL: the channel itself).
+void analyseClip(clipInfo* ci, assetArena* arena, const aiAnimation* anim, const int* channelNode, aiNodeAnim** posnChannels = NULL,
+	float posnTolerance = 1e-4f, float rotnTolerance = 1e-7f)
+{
+	int n = anim->mNumChannels;
+	ci->anim = anim;
+	ci->nChannels = n;
+	ci->posnChannel = arenaAlloc<aiNodeAnim*>(arena, ARENA_CLIPS, n);
+	ci->node = arenaAlloc<int>(arena, ARENA_CLIPS, n);
+	ci->constPosn = arenaAlloc<bool>(arena, ARENA_CLIPS, n);
+	ci->constRotn = arenaAlloc<bool>(arena, ARENA_CLIPS, n);
+	ci->bound = arenaAlloc<int>(arena, ARENA_CLIPS, n);
+	ci->animated = arenaAlloc<int>(arena, ARENA_CLIPS, n);
+	ci->nBound = ci->nAnimated = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		aiNodeAnim* channel = anim->mChannels[i];
+		ci->posnChannel[i] = (posnChannels != NULL) ? posnChannels[i] : channel;
+		ci->node[i] = (channelNode != NULL) ? channelNode[i] : i;
+		ci->constPosn[i] = isConstantPosition(ci->posnChannel[i], posnTolerance);
+		ci->constRotn[i] = isConstantRotation(channel, rotnTolerance);
+
+		if (ci->node[i] < 0) continue;
+		ci->bound[ci->nBound++] = i;
+		if (!ci->constPosn[i] || !ci->constRotn[i]) ci->animated[ci->nAnimated++] = i;
+	}
+
+	//Channels in skeleton order: a skeleton level of detail evaluates a prefix of them
+	const int* node = ci->node;
+	std::stable_sort(ci->bound, ci->bound + ci->nBound, [node](int a, int b) { return node[a] < node[b]; });
+	std::stable_sort(ci->animated, ci->animated + ci->nAnimated, [node](int a, int b) { return node[a] < node[b]; });
+}
+
+// ----------------------------------------------------------------------------
+// Reports the fraction of per-tick work removed, relative to sampling the
+// position and rotation tracks of every channel on every tick.
+void printClipAnalysis(const clipInfo* ci, const char* name)
+{
+	int nPosn = 0, nRotn = 0, nTracks = 0;
+	for (int i = 0; i < ci->nChannels; i++)
+	{
+		if (ci->constPosn[i]) nPosn++;
+		if (ci->constRotn[i]) nRotn++;
+	}
+	for (int c = 0; c < ci->nAnimated; c++)
+	{
+		int i = ci->animated[c];
+		nTracks += (ci->constPosn[i] ? 0 : 1) + (ci->constRotn[i] ? 0 : 1);
+	}
+	cout << "Clip analysis (" << name << "): " << ci->nChannels << " channels, " << ci->nBound << " bound; constant tracks: "
+		<< nPosn << " position, " << nRotn << " rotation; constant channels: " << ci->nBound - ci->nAnimated << endl;
+	cout << "    per tick: " << ci->nAnimated << "/" << ci->nChannels << " channels evaluated ("
+		<< 100.0f * (ci->nChannels - ci->nAnimated) / ci->nChannels << "% removed), "
+		<< nTracks << "/" << 2 * ci->nChannels << " tracks sampled ("
+		<< 100.0f * (2 * ci->nChannels - nTracks) / (2 * ci->nChannels) << "% removed)" << endl;
+}
+
+// ----------------------------------------------------------------------------
+// Imports a clip file and prints its analysis (all channels treated as bound)
+int analyseClipFile(const char* fileName)
+{
+	const aiScene* sc = aiImportFile(fileName, aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_Debone);
+	if (sc == NULL || !sc->HasAnimations())
+	{
+		cout << "No animation found in " << fileName << endl;
+		return 1;
+	}
+	clipInfo ci;
+	assetArena arena;
+	createArena(&arena, fileName);
+	analyseClip(&ci, &arena, sc->mAnimations[0], NULL);
+	printClipAnalysis(&ci, fileName);
+	releaseArena(&arena);
+	aiReleaseImport(sc);
+	return 0;
+}
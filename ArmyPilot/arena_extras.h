@@ -0,0 +1,201 @@
+// ----------------------------------------------------------------------------
+// Asset arena helper functions
+//
+// The runtime data built from a loaded asset (bind pose, bone weights, skinning
+// state, skeleton, clip tables, level of detail faces) is allocated from the
+// asset's arena: large blocks carved front to back, every array aligned to a
+// cache line. Unloading the asset releases all of it in one call, and the
+// arena counts the bytes requested by each category, so a report gives the
+// exact footprint of each asset. Destructors are not run: only plain data, or
+// assimp types whose owned arrays also live in the arena (aiFace), may be
+// stored. Temporary arrays of the build functions stay on the heap.
+//-----------------------------------------------------------------------------
+
+#include <new>
+#include <cstdlib>
+#include <cstdio>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#define ARENA_ALIGN 64               //Alignment of every allocation (one cache line)
+#define ARENA_BLOCK_SIZE (1 << 20)   //Default block size; larger requests get a block of their own
+
+enum arenaCategory { ARENA_BIND_POSE, ARENA_WEIGHTS, ARENA_SKINNING, ARENA_SKELETON, ARENA_CLIPS, ARENA_LODS, ARENA_CATEGORIES };
+const char* arenaCategoryNames[ARENA_CATEGORIES] = { "bind pose", "weights", "skinning", "skeleton", "clips", "lods" };
+
+struct arenaBlock
+{
+	arenaBlock* next;
+	void* memory;                 //As returned by malloc
+	size_t size;                  //Usable bytes after the (aligned) header
+	size_t used;
+};
+
+struct assetArena
+{
+	const char* name;
+	size_t blockSize;
+	arenaBlock* blocks;           //Most recent block first; allocations come from its tail
+	int nBlocks;
+	size_t reserved;              //Bytes obtained from the heap
+	size_t padding;               //Bytes lost to alignment
+	size_t bytes[ARENA_CATEGORIES];   //Bytes requested by each category
+	int nArrays[ARENA_CATEGORIES];
+};
+
+// ----------------------------------------------------------------------------
+void createArena(assetArena* arena, const char* name, size_t blockSize = ARENA_BLOCK_SIZE)
+{
+	arena->name = name;
+	arena->blockSize = blockSize;
+	arena->blocks = NULL;
+	arena->nBlocks = 0;
+	arena->reserved = arena->padding = 0;
+	for (int c = 0; c < ARENA_CATEGORIES; c++)
+	{
+		arena->bytes[c] = 0;
+		arena->nArrays[c] = 0;
+	}
+}
+
+// ----------------------------------------------------------------------------
+size_t arenaHeaderSize()
+{
+	return (sizeof(arenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// ----------------------------------------------------------------------------
+// Returns "size" bytes aligned to ARENA_ALIGN, counted against "category"
+void* arenaAllocBytes(assetArena* arena, int category, size_t size)
+{
+	size_t aligned = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	arenaBlock* b = arena->blocks;
+	if (b == NULL || b->used + aligned > b->size)
+	{
+		//A request larger than a block gets one of its own, behind the current block (which keeps filling)
+		bool own = (aligned > arena->blockSize && b != NULL);
+		size_t blockSize = aisgl_max(arena->blockSize, aligned);
+		size_t total = arenaHeaderSize() + blockSize + ARENA_ALIGN;
+		unsigned char* mem = (unsigned char*)malloc(total);
+		if (mem == NULL)
+		{
+			cout << "Arena " << arena->name << ": out of memory (" << total << " bytes)" << endl;
+			exit(1);
+		}
+		//The header sits at the first aligned address, so the data after it is aligned too
+		unsigned char* start = (unsigned char*)(((size_t)mem + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+		b = (arenaBlock*)start;
+		b->memory = mem;
+		b->size = blockSize;
+		b->used = 0;
+		if (own)
+		{
+			b->next = arena->blocks->next;
+			arena->blocks->next = b;
+		}
+		else
+		{
+			b->next = arena->blocks;
+			arena->blocks = b;
+		}
+		arena->nBlocks++;
+		arena->reserved += total;
+	}
+	void* p = (unsigned char*)b + arenaHeaderSize() + b->used;
+	b->used += aligned;
+	arena->bytes[category] += size;
+	arena->nArrays[category]++;
+	arena->padding += aligned - size;
+	return p;
+}
+
+// ----------------------------------------------------------------------------
+// Array of n default-constructed elements
+template <class T> T* arenaAlloc(assetArena* arena, int category, int n)
+{
+	T* p = (T*)arenaAllocBytes(arena, category, (size_t)aisgl_max(n, 0) * sizeof(T));
+	for (int i = 0; i < n; i++) new (p + i) T();
+	return p;
+}
+
+// ----------------------------------------------------------------------------
+template <class T> T* arenaCopy(assetArena* arena, int category, const T* src, int n)
+{
+	T* p = (T*)arenaAllocBytes(arena, category, (size_t)aisgl_max(n, 0) * sizeof(T));
+	for (int i = 0; i < n; i++) new (p + i) T(src[i]);
+	return p;
+}
+
+// ----------------------------------------------------------------------------
+size_t arenaBytes(const assetArena* arena)
+{
+	size_t total = 0;
+	for (int c = 0; c < ARENA_CATEGORIES; c++) total += arena->bytes[c];
+	return total;
+}
+
+// ----------------------------------------------------------------------------
+// Frees every block; the arena can be reused for the next asset
+void releaseArena(assetArena* arena)
+{
+	while (arena->blocks != NULL)
+	{
+		arenaBlock* b = arena->blocks;
+		arena->blocks = b->next;
+		free(b->memory);
+	}
+	createArena(arena, arena->name, arena->blockSize);
+}
+
+// ----------------------------------------------------------------------------
+void printArenaUsage(const assetArena* arena)
+{
+	cout << "Arena " << arena->name << ": " << arenaBytes(arena) << " bytes in use (";
+	bool first = true;
+	for (int c = 0; c < ARENA_CATEGORIES; c++)
+	{
+		if (arena->nArrays[c] == 0) continue;
+		cout << (first ? "" : ", ") << arenaCategoryNames[c] << " " << arena->bytes[c];
+		first = false;
+	}
+	cout << "), " << arena->padding << " alignment padding, " << arena->reserved << " reserved in "
+		<< arena->nBlocks << " block" << (arena->nBlocks == 1 ? "" : "s") << endl;
+}
+
+// ----------------------------------------------------------------------------
+// Frees the bone weights of a scene once the influence tables (skinnedMesh) hold
+// them; the bones keep their names and offset matrices. Returns the bytes freed.
+size_t releaseBoneWeights(const aiScene* sc)
+{
+	size_t freed = 0;
+	for (int m = 0; m < sc->mNumMeshes; m++)
+	{
+		const aiMesh* mesh = sc->mMeshes[m];
+		for (int j = 0; j < mesh->mNumBones; j++)
+		{
+			aiBone* bone = mesh->mBones[j];
+			freed += bone->mNumWeights * sizeof(aiVertexWeight);
+			delete[] bone->mWeights;
+			bone->mWeights = NULL;
+			bone->mNumWeights = 0;
+		}
+	}
+	return freed;
+}
+
+// ----------------------------------------------------------------------------
+// Resident set size of the process in bytes (0 where /proc is not available)
+size_t residentBytes()
+{
+	long pages = 0, resident = 0;
+	FILE* fp = fopen("/proc/self/statm", "r");
+	if (fp == NULL) return 0;
+	if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) resident = 0;
+	fclose(fp);
+#ifdef __linux__
+	return (size_t)resident * sysconf(_SC_PAGESIZE);
+#else
+	return 0;
+#endif
+}
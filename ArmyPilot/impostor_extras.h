@@ -0,0 +1,152 @@
+// ----------------------------------------------------------------------------
+// Impostor helper functions
+//
+// A clip is pre-rendered from a ring of view angles around the vertical axis
+// into a sprite atlas (one row per view, one column per animation frame),
+// through a framebuffer object with a texture attached, so that it works in a
+// window as well as in a headless context. The views are orthographic and
+// framed by the model's bounding sphere. Very distant instances are then drawn
+// as textured quads that turn about the vertical axis to face the camera,
+// showing the nearest baked view and frame: four vertices per instance,
+// whatever the model's complexity.
+//-----------------------------------------------------------------------------
+
+#define IMPOSTOR_VIEWS 8
+#define IMPOSTOR_FRAMES 16
+#define IMPOSTOR_CELL 64               //Size of an atlas cell (pixels)
+#define IMPOSTOR_SCREEN_SIZE 40.0f     //Projected size (pixels) below which a crowd instance becomes an impostor
+#define IMPOSTOR_LOD MAX_LODS          //Level of detail given to impostor instances (sorted after all mesh levels)
+
+struct impostorAtlas
+{
+	const aiAnimation* clip;
+	int nViews, nFrames, cellSize;
+	int duration;                 //Ticks of the clip; frame f shows tick f * duration / nFrames
+	GLuint texture;               //nFrames x nViews cells, RGBA (alpha 0 outside the model)
+	aiVector3D centre;            //Centre of the bounding sphere, relative to the drawn model's position
+	float radius;
+	double bakeTime;              //Seconds
+};
+
+// ----------------------------------------------------------------------------
+// Renders the atlas. "poseFrame" poses and skins the model at a tick;
+// "drawModel" draws it at the origin of the frame where "centre" is given.
+// The current framebuffer, viewport and matrices are restored afterwards.
+bool bakeImpostors(impostorAtlas* ia, const aiAnimation* clip, aiVector3D centre, float radius,
+	void (*poseFrame)(int), void (*drawModel)())
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	ia->clip = clip;
+	ia->nViews = IMPOSTOR_VIEWS;
+	ia->nFrames = IMPOSTOR_FRAMES;
+	ia->cellSize = IMPOSTOR_CELL;
+	ia->duration = aisgl_max((int)clip->mDuration, 1);
+	ia->centre = centre;
+	ia->radius = 1.05f * radius;  //Margin for poses that leave the bind pose bounds
+	int width = ia->nFrames * ia->cellSize, height = ia->nViews * ia->cellSize;
+
+	glGenTextures(1, &ia->texture);
+	glBindTexture(GL_TEXTURE_2D, ia->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	GLint previousFbo, viewport[4];
+	GLfloat clearColour[4];
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFbo);
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColour);
+	GLuint fbo, depthBuffer;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ia->texture, 0);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	bool ok = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	if (!ok) cout << "Impostors: framebuffer object incomplete" << endl;
+
+	if (ok)
+	{
+		glViewport(0, 0, width, height);
+		glClearColor(0, 0, 0, 0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glMatrixMode(GL_PROJECTION);
+		glPushMatrix();
+		glLoadIdentity();
+		glOrtho(-ia->radius, ia->radius, -ia->radius, ia->radius, 0, 4 * ia->radius);
+		glMatrixMode(GL_MODELVIEW);
+		glPushMatrix();
+		for (int f = 0; f < ia->nFrames; f++)
+		{
+			poseFrame(f * ia->duration / ia->nFrames);
+			for (int v = 0; v < ia->nViews; v++)
+			{
+				float angle = 2 * AI_MATH_PI_F * v / ia->nViews;
+				glViewport(f * ia->cellSize, v * ia->cellSize, ia->cellSize, ia->cellSize);
+				glLoadIdentity();
+				float light[4] = { 0, 1, 1, 0 };   //From above the camera
+				glLightfv(GL_LIGHT0, GL_POSITION, light);
+				gluLookAt(centre.x + 2 * ia->radius * sin(angle), centre.y, centre.z + 2 * ia->radius * cos(angle),
+					centre.x, centre.y, centre.z, 0, 1, 0);
+				drawModel();
+			}
+		}
+		glMatrixMode(GL_PROJECTION);
+		glPopMatrix();
+		glMatrixMode(GL_MODELVIEW);
+		glPopMatrix();
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, previousFbo);
+	glDeleteRenderbuffers(1, &depthBuffer);
+	glDeleteFramebuffers(1, &fbo);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glClearColor(clearColour[0], clearColour[1], clearColour[2], clearColour[3]);
+	ia->bakeTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (ok) cout << "Impostors: " << ia->nViews << " views x " << ia->nFrames << " frames, atlas " << width << "x"
+		<< height << " (" << width * height * 4 / 1024 << " KB), baked in " << 1000 * ia->bakeTime << " ms" << endl;
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+// Sets up the state for drawing impostors; drawImpostor() calls must follow, then endImpostors()
+void beginImpostors(const impostorAtlas* ia)
+{
+	glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT | GL_COLOR_BUFFER_BIT);
+	glDisable(GL_LIGHTING);
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, ia->texture);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glEnable(GL_ALPHA_TEST);
+	glAlphaFunc(GL_GREATER, 0.5f);
+	glBegin(GL_QUADS);
+}
+
+// ----------------------------------------------------------------------------
+// Adds the quad of an instance drawn at "posn", seen from "eye" (same frame)
+void drawImpostor(const impostorAtlas* ia, aiVector3D posn, int tick, aiVector3D eye)
+{
+	aiVector3D c = posn + ia->centre;
+	float angle = atan2(eye.x - c.x, eye.z - c.z);
+	int view = (int)floor(angle * ia->nViews / (2 * AI_MATH_PI_F) + 0.5f) % ia->nViews;
+	if (view < 0) view += ia->nViews;
+	int frame = (tick % ia->duration) * ia->nFrames / ia->duration;
+	float s0 = (float)frame / ia->nFrames, s1 = (float)(frame + 1) / ia->nFrames;
+	float t0 = (float)view / ia->nViews, t1 = (float)(view + 1) / ia->nViews;
+	float r = ia->radius, dx = r * cos(angle), dz = -r * sin(angle);   //Right vector of the quad
+	glTexCoord2f(s0, t0); glVertex3f(c.x - dx, c.y - r, c.z - dz);
+	glTexCoord2f(s1, t0); glVertex3f(c.x + dx, c.y - r, c.z + dz);
+	glTexCoord2f(s1, t1); glVertex3f(c.x + dx, c.y + r, c.z + dz);
+	glTexCoord2f(s0, t1); glVertex3f(c.x - dx, c.y + r, c.z - dz);
+}
+
+// ----------------------------------------------------------------------------
+void endImpostors()
+{
+	glEnd();
+	glPopAttrib();
+}
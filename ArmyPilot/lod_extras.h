@@ -0,0 +1,335 @@
+// ----------------------------------------------------------------------------
+// Level of detail helper functions
+//
+// Each triangle mesh is simplified at load into a chain of MAX_LODS levels,
+// each with about half the triangles of the previous one, by quadric error
+// half-edge collapses (a vertex is merged into one of its neighbours, so no
+// new vertices or bone weights are created). Vertices on open edges, which
+// include the UV and normal seams split by the importer, are never moved.
+// A collapse is penalised by the difference of the two vertices' bone weights,
+// and rejected if it flips a triangle, which keeps limbs apart and the
+// silhouette intact.
+//
+// The vertices are then sorted by the coarsest level that uses them, so that
+// every level uses a prefix of the vertex arrays and only that prefix needs to
+// be skinned. Must be called after optimizeMeshes() and before any copy of the
+// vertex data (initData, skinnedMesh) is made. The faces of the simplified
+// levels are allocated from the asset's arena.
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+
+#define MAX_LODS 4
+#define LOD_SCREEN_SIZE 400.0f    //Projected size (pixels) below which level 1 is used; halved for each further level
+#define LOD_WEIGHT_PENALTY 4.0f   //Cost of merging vertices with different bone weights (x squared edge length)
+
+struct meshLod
+{
+	int nLods;
+	int nVertices[MAX_LODS];      //Vertices used by the level: vertices 0 .. nVertices-1
+	int nFaces[MAX_LODS];
+	aiFace* faces[MAX_LODS];      //Level 0 is the mesh's own face array
+	float error[MAX_LODS];        //Largest collapse cost accepted up to the level
+};
+
+struct quadric
+{
+	double a[10];                 //Upper triangle of the symmetric 4x4 matrix, row by row
+};
+
+struct lodCollapse
+{
+	float cost;
+	int u, v;                     //Vertex u is merged into vertex v
+	int stampU, stampV;           //Stamps of u and v when the cost was computed
+	bool operator<(const lodCollapse& c) const { return cost > c.cost; }   //Cheapest first
+};
+
+// ----------------------------------------------------------------------------
+void addPlaneQuadric(quadric* q, aiVector3D n, float d)
+{
+	double p[4] = { n.x, n.y, n.z, d };
+	int k = 0;
+	for (int i = 0; i < 4; i++)
+		for (int j = i; j < 4; j++) q->a[k++] += p[i] * p[j];
+}
+
+double evaluateQuadric(const quadric* q, aiVector3D v)
+{
+	double p[4] = { v.x, v.y, v.z, 1 };
+	double sum = 0;
+	int k = 0;
+	for (int i = 0; i < 4; i++)
+		for (int j = i; j < 4; j++) sum += (i == j ? 1 : 2) * q->a[k++] * p[i] * p[j];
+	return sum;
+}
+
+// ----------------------------------------------------------------------------
+// Sum of the absolute weight differences of two vertices (0 = same weights, 2 = disjoint bones)
+float weightDistance(const std::vector<std::pair<int, float> >& wu, const std::vector<std::pair<int, float> >& wv)
+{
+	float dist = 0;
+	int i = 0, j = 0;
+	while (i < wu.size() || j < wv.size())
+	{
+		if (j == wv.size() || (i < wu.size() && wu[i].first < wv[j].first)) dist += wu[i++].second;
+		else if (i == wu.size() || wv[j].first < wu[i].first) dist += wv[j++].second;
+		else dist += fabs(wu[i++].second - wv[j++].second);
+	}
+	return dist;
+}
+
+// ----------------------------------------------------------------------------
+// Working state of the simplification of one mesh
+struct lodBuilder
+{
+	const aiMesh* mesh;
+	std::vector<int> tri;                        //3 vertex indices per triangle
+	std::vector<bool> triAlive;
+	std::vector<std::vector<int> > vertTris;     //Triangles using each vertex (may include dead ones)
+	std::vector<quadric> q;
+	std::vector<std::vector<std::pair<int, float> > > weights;   //(bone, weight) in bone order
+	std::vector<bool> locked, removed;
+	std::vector<int> stamp;
+	std::priority_queue<lodCollapse> heap;
+};
+
+aiVector3D triangleNormal(const lodBuilder* lb, int t, int u, int v)
+{
+	aiVector3D p[3];
+	for (int i = 0; i < 3; i++)
+	{
+		int w = lb->tri[3 * t + i];
+		p[i] = lb->mesh->mVertices[w == u ? v : w];
+	}
+	return (p[1] - p[0]) ^ (p[2] - p[0]);
+}
+
+// ----------------------------------------------------------------------------
+// Cost of merging u into v, or a negative value if the collapse is not allowed
+float collapseCost(const lodBuilder* lb, int u, int v)
+{
+	if (lb->locked[u] || lb->removed[u] || lb->removed[v]) return -1;
+	for (int k = 0; k < lb->vertTris[u].size(); k++)
+	{
+		int t = lb->vertTris[u][k];
+		if (!lb->triAlive[t] || lb->tri[3 * t] == v || lb->tri[3 * t + 1] == v || lb->tri[3 * t + 2] == v) continue;
+		aiVector3D before = triangleNormal(lb, t, u, u), after = triangleNormal(lb, t, u, v);
+		float len = before.Length() * after.Length();
+		if (len == 0 || before * after < 0.2f * len) return -1;     //Flipped or nearly folded over
+	}
+	quadric sum = lb->q[u];
+	for (int k = 0; k < 10; k++) sum.a[k] += lb->q[v].a[k];
+	aiVector3D pv = lb->mesh->mVertices[v];
+	float edge = (pv - lb->mesh->mVertices[u]).SquareLength();
+	return (float)fabs(evaluateQuadric(&sum, pv)) + LOD_WEIGHT_PENALTY * weightDistance(lb->weights[u], lb->weights[v]) * edge;
+}
+
+void pushCollapse(lodBuilder* lb, int u, int v)
+{
+	float cost = collapseCost(lb, u, v);
+	if (cost < 0) return;
+	lodCollapse c = { cost, u, v, lb->stamp[u], lb->stamp[v] };
+	lb->heap.push(c);
+}
+
+// Pushes both directions of every edge around vertex v
+void pushVertexCollapses(lodBuilder* lb, int v)
+{
+	for (int k = 0; k < lb->vertTris[v].size(); k++)
+	{
+		int t = lb->vertTris[v][k];
+		if (!lb->triAlive[t]) continue;
+		for (int i = 0; i < 3; i++)
+		{
+			int w = lb->tri[3 * t + i];
+			if (w == v) continue;
+			pushCollapse(lb, v, w);
+			pushCollapse(lb, w, v);
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Merges u into v; returns the number of triangles removed
+int applyCollapse(lodBuilder* lb, int u, int v)
+{
+	int nRemoved = 0;
+	for (int k = 0; k < lb->vertTris[u].size(); k++)
+	{
+		int t = lb->vertTris[u][k];
+		if (!lb->triAlive[t]) continue;
+		int* ti = &lb->tri[3 * t];
+		if (ti[0] == v || ti[1] == v || ti[2] == v)
+		{
+			lb->triAlive[t] = false;
+			nRemoved++;
+			continue;
+		}
+		for (int i = 0; i < 3; i++)
+			if (ti[i] == u) ti[i] = v;
+		lb->vertTris[v].push_back(t);
+	}
+	for (int k = 0; k < 10; k++) lb->q[v].a[k] += lb->q[u].a[k];
+	lb->removed[u] = true;
+	lb->vertTris[u].clear();
+	lb->stamp[v]++;
+	return nRemoved;
+}
+
+// ----------------------------------------------------------------------------
+aiFace* copyAliveTriangles(const lodBuilder* lb, int nAlive, assetArena* arena)
+{
+	aiFace* faces = arenaAlloc<aiFace>(arena, ARENA_LODS, nAlive);
+	unsigned int* indices = arenaAlloc<unsigned int>(arena, ARENA_LODS, 3 * nAlive);
+	int n = 0;
+	for (int t = 0; t < lb->triAlive.size(); t++)
+	{
+		if (!lb->triAlive[t]) continue;
+		faces[n].mNumIndices = 3;
+		faces[n].mIndices = &indices[3 * n];
+		for (int i = 0; i < 3; i++) faces[n].mIndices[i] = lb->tri[3 * t + i];
+		n++;
+	}
+	return faces;
+}
+
+// ----------------------------------------------------------------------------
+// Builds the level of detail chain of a mesh and reorders its vertices so that
+// each level uses a prefix of them. Meshes that are not made of triangles keep
+// a single level.
+void buildMeshLods(meshLod* lod, assetArena* arena, aiMesh* mesh)
+{
+	int nverts = mesh->mNumVertices, ntris = mesh->mNumFaces;
+	lod->nLods = 1;
+	lod->nVertices[0] = nverts;
+	lod->nFaces[0] = ntris;
+	lod->faces[0] = mesh->mFaces;
+	lod->error[0] = 0;
+	for (int k = 0; k < ntris; k++)
+		if (mesh->mFaces[k].mNumIndices != 3) return;
+	if (ntris == 0) return;
+
+	lodBuilder lb;
+	lb.mesh = mesh;
+	lb.tri.resize(3 * ntris);
+	lb.triAlive.assign(ntris, true);
+	lb.vertTris.resize(nverts);
+	lb.q.resize(nverts);
+	lb.weights.resize(nverts);
+	lb.locked.assign(nverts, false);
+	lb.removed.assign(nverts, false);
+	lb.stamp.assign(nverts, 0);
+	for (int v = 0; v < nverts; v++)
+		for (int k = 0; k < 10; k++) lb.q[v].a[k] = 0;
+
+	for (int t = 0; t < ntris; t++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			lb.tri[3 * t + i] = mesh->mFaces[t].mIndices[i];
+			lb.vertTris[lb.tri[3 * t + i]].push_back(t);
+		}
+		aiVector3D n = triangleNormal(&lb, t, -1, -1);
+		if (n.Length() == 0) continue;
+		n.Normalize();
+		float d = -(n * mesh->mVertices[lb.tri[3 * t]]);
+		for (int i = 0; i < 3; i++) addPlaneQuadric(&lb.q[lb.tri[3 * t + i]], n, d);
+	}
+	for (int j = 0; j < mesh->mNumBones; j++)
+	{
+		const aiBone* bone = mesh->mBones[j];
+		for (int k = 0; k < bone->mNumWeights; k++)
+			lb.weights[bone->mWeights[k].mVertexId].push_back(std::make_pair(j, bone->mWeights[k].mWeight));
+	}
+
+	//An edge used by a single triangle is open (mesh border or seam): lock its vertices
+	for (int v = 0; v < nverts; v++)
+	{
+		std::vector<int> nbrs;
+		for (int k = 0; k < lb.vertTris[v].size(); k++)
+			for (int i = 0; i < 3; i++)
+				if (lb.tri[3 * lb.vertTris[v][k] + i] != v) nbrs.push_back(lb.tri[3 * lb.vertTris[v][k] + i]);
+		std::sort(nbrs.begin(), nbrs.end());
+		for (int k = 0; k < nbrs.size() && !lb.locked[v]; k++)
+		{
+			bool single = (k == 0 || nbrs[k - 1] != nbrs[k]) && (k + 1 == nbrs.size() || nbrs[k + 1] != nbrs[k]);
+			if (single) lb.locked[v] = true;
+		}
+	}
+
+	for (int v = 0; v < nverts; v++) pushVertexCollapses(&lb, v);
+
+	int nAlive = ntris;
+	float maxCost = 0;
+	while (lod->nLods < MAX_LODS)
+	{
+		int target = ntris >> lod->nLods;
+		while (nAlive > target && !lb.heap.empty())
+		{
+			lodCollapse c = lb.heap.top();
+			lb.heap.pop();
+			if (c.stampU != lb.stamp[c.u] || c.stampV != lb.stamp[c.v]) continue;   //Stale entry
+			if (collapseCost(&lb, c.u, c.v) < 0) continue;                            //No longer allowed
+			nAlive -= applyCollapse(&lb, c.u, c.v);
+			maxCost = aisgl_max(maxCost, c.cost);
+			pushVertexCollapses(&lb, c.v);
+		}
+		if (nAlive == lod->nFaces[lod->nLods - 1]) break;    //No further reduction possible
+		lod->nFaces[lod->nLods] = nAlive;
+		lod->faces[lod->nLods] = copyAliveTriangles(&lb, nAlive, arena);
+		lod->error[lod->nLods] = maxCost;
+		lod->nLods++;
+		if (lb.heap.empty()) break;
+	}
+
+	//Sort the vertices by the coarsest level using them (unused vertices count as level 0)
+	int* level = new int[nverts];
+	for (int v = 0; v < nverts; v++) level[v] = 0;
+	for (int l = 1; l < lod->nLods; l++)
+		for (int k = 0; k < lod->nFaces[l]; k++)
+			for (int i = 0; i < 3; i++) level[lod->faces[l][k].mIndices[i]] = l;
+	int* newIndex = new int[nverts];
+	int next = 0;
+	for (int l = lod->nLods - 1; l >= 0; l--)
+	{
+		for (int v = 0; v < nverts; v++)
+			if (level[v] == l) newIndex[v] = next++;
+		lod->nVertices[l] = next;
+	}
+	permuteVertices(mesh, newIndex);
+	for (int l = 0; l < lod->nLods; l++)
+		for (int k = 0; k < lod->nFaces[l]; k++)
+			for (int i = 0; i < 3; i++)
+				lod->faces[l][k].mIndices[i] = newIndex[lod->faces[l][k].mIndices[i]];
+	delete[] level;
+	delete[] newIndex;
+}
+
+// ----------------------------------------------------------------------------
+void printMeshLods(const meshLod* lod, int meshIndex)
+{
+	cout << "Mesh " << meshIndex << " LODs:";
+	for (int l = 0; l < lod->nLods; l++)
+		cout << "  [" << l << "] " << lod->nVertices[l] << " vertices, " << lod->nFaces[l] << " faces";
+	cout << endl;
+}
+
+// ----------------------------------------------------------------------------
+// Projected diameter in pixels of a sphere of the given radius at the given distance
+float projectedSize(float radius, float distance, float fovY, int viewportHeight)
+{
+	if (distance <= radius) return (float)viewportHeight;
+	return viewportHeight * radius / (distance * tanf(0.5f * fovY * AI_MATH_PI_F / 180.0f));
+}
+
+// ----------------------------------------------------------------------------
+// Level of detail for a projected size (levels beyond a mesh's chain use its coarsest level)
+int selectLod(float pixels)
+{
+	int level = 0;
+	while (level < MAX_LODS - 1 && pixels < LOD_SCREEN_SIZE / (1 << level)) level++;
+	return level;
+}
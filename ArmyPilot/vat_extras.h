@@ -0,0 +1,227 @@
+// ----------------------------------------------------------------------------
+// Vertex animation helper functions
+//
+// A clip is baked by running the normal skinning over every tick and storing
+// the skinned positions (16 bits per component, relative to the bounds of the
+// whole clip) and normals (8 bits per component). Playback decodes one frame
+// into the mesh arrays, with no skeleton evaluation at all; only the vertex
+// prefix of the current level of detail is decoded. A mesh without normals
+// keeps its place in the normal block, as zeros, and none are decoded for it. The baked data can be
+// saved to and loaded from a binary file (header, bounds, then the frames).
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <chrono>
+
+#define VAT_MIN_LOD 2             //Crowd instances at this level of detail or coarser are played back
+
+struct vertexAnimation
+{
+	const aiAnimation* clip;      //Clip that was baked
+	int nFrames;                  //One frame per tick
+	int nMeshes;
+	int* nVertices;               //Vertices of each mesh
+	int frameSize;                //Vertices per frame, over all meshes
+	aiVector3D boundsMin, boundsMax;   //Bounds of all positions over the clip
+	unsigned short* positions;    //nFrames x frameSize x 3
+	signed char* normals;         //nFrames x frameSize x 3
+	double bakeTime;              //Seconds spent skinning the frames
+};
+
+// ----------------------------------------------------------------------------
+void allocateVertexAnimation(vertexAnimation* vat, int nFrames, int nMeshes)
+{
+	vat->nFrames = nFrames;
+	vat->nMeshes = nMeshes;
+	vat->nVertices = new int[nMeshes];
+	vat->frameSize = 0;
+	vat->positions = NULL;
+	vat->normals = NULL;
+}
+
+// ----------------------------------------------------------------------------
+void releaseVertexAnimation(vertexAnimation* vat)
+{
+	delete[] vat->nVertices;
+	delete[] vat->positions;
+	delete[] vat->normals;
+	vat->nVertices = NULL;
+	vat->positions = NULL;
+	vat->normals = NULL;
+	vat->nFrames = vat->frameSize = 0;
+}
+
+// ----------------------------------------------------------------------------
+// Bakes nFrames ticks of the clip. "poseFrame" must pose the skeleton at the
+// given tick and skin the meshes (at the finest level of detail).
+void bakeVertexAnimation(vertexAnimation* vat, const aiAnimation* clip, int nFrames,
+	const skinnedMesh* skinData, int nMeshes, void (*poseFrame)(int))
+{
+	allocateVertexAnimation(vat, nFrames, nMeshes);
+	vat->clip = clip;
+	for (int m = 0; m < nMeshes; m++)
+	{
+		vat->nVertices[m] = skinData[m].mesh->mNumVertices;
+		vat->frameSize += vat->nVertices[m];
+	}
+
+	//Skin every frame into float buffers, then quantise against the clip's bounds
+	int n = nFrames * vat->frameSize;
+	aiVector3D* posn = new aiVector3D[n];
+	aiVector3D* norm = new aiVector3D[n];
+	vat->boundsMin = aiVector3D(1e10f, 1e10f, 1e10f);
+	vat->boundsMax = aiVector3D(-1e10f, -1e10f, -1e10f);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int f = 0; f < nFrames; f++)
+	{
+		poseFrame(f);
+		int k = f * vat->frameSize;
+		for (int m = 0; m < nMeshes; m++)
+		{
+			const aiMesh* mesh = skinData[m].mesh;
+			bool normals = skinData[m].normals;
+			for (int v = 0; v < vat->nVertices[m]; v++, k++)
+			{
+				posn[k] = mesh->mVertices[v];
+				norm[k] = normals ? mesh->mNormals[v] : aiVector3D(0, 0, 0);
+			}
+		}
+	}
+	vat->bakeTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	for (int k = 0; k < n; k++)
+	{
+		vat->boundsMin.x = aisgl_min(vat->boundsMin.x, posn[k].x);
+		vat->boundsMin.y = aisgl_min(vat->boundsMin.y, posn[k].y);
+		vat->boundsMin.z = aisgl_min(vat->boundsMin.z, posn[k].z);
+		vat->boundsMax.x = aisgl_max(vat->boundsMax.x, posn[k].x);
+		vat->boundsMax.y = aisgl_max(vat->boundsMax.y, posn[k].y);
+		vat->boundsMax.z = aisgl_max(vat->boundsMax.z, posn[k].z);
+	}
+
+	vat->positions = new unsigned short[3 * n];
+	vat->normals = new signed char[3 * n];
+	aiVector3D size = vat->boundsMax - vat->boundsMin;
+	float scale[3] = { size.x > 0 ? 65535 / size.x : 0, size.y > 0 ? 65535 / size.y : 0, size.z > 0 ? 65535 / size.z : 0 };
+	for (int k = 0; k < n; k++)
+	{
+		aiVector3D p = posn[k] - vat->boundsMin;
+		vat->positions[3 * k] = (unsigned short)(p.x * scale[0] + 0.5f);
+		vat->positions[3 * k + 1] = (unsigned short)(p.y * scale[1] + 0.5f);
+		vat->positions[3 * k + 2] = (unsigned short)(p.z * scale[2] + 0.5f);
+		aiVector3D q = norm[k];
+		if (q.Length() > 0) q.Normalize();
+		vat->normals[3 * k] = (signed char)floor(q.x * 127 + 0.5f);
+		vat->normals[3 * k + 1] = (signed char)floor(q.y * 127 + 0.5f);
+		vat->normals[3 * k + 2] = (signed char)floor(q.z * 127 + 0.5f);
+	}
+	delete[] posn;
+	delete[] norm;
+}
+
+// ----------------------------------------------------------------------------
+// Decodes a frame into the meshes, up to each mesh's active vertex count
+void playVertexAnimation(const vertexAnimation* vat, int frame, skinnedMesh* skinData)
+{
+	if (frame < 0) frame = 0;
+	if (frame >= vat->nFrames) frame = vat->nFrames - 1;
+	aiVector3D size = vat->boundsMax - vat->boundsMin;
+	aiVector3D step(size.x / 65535, size.y / 65535, size.z / 65535);
+	const unsigned short* p = vat->positions + 3 * frame * vat->frameSize;
+	const signed char* q = vat->normals + 3 * frame * vat->frameSize;
+	for (int m = 0; m < vat->nMeshes; m++)
+	{
+		aiMesh* mesh = skinData[m].mesh;
+		int nActive = skinData[m].nActive;
+		for (int v = 0; v < nActive; v++)
+			mesh->mVertices[v] = aiVector3D(vat->boundsMin.x + p[3 * v] * step.x,
+				vat->boundsMin.y + p[3 * v + 1] * step.y, vat->boundsMin.z + p[3 * v + 2] * step.z);
+		if (skinData[m].normals)
+			for (int v = 0; v < nActive; v++)
+				mesh->mNormals[v] = aiVector3D(q[3 * v] / 127.0f, q[3 * v + 1] / 127.0f, q[3 * v + 2] / 127.0f);
+		p += 3 * vat->nVertices[m];
+		q += 3 * vat->nVertices[m];
+	}
+}
+
+// ----------------------------------------------------------------------------
+bool saveVertexAnimation(const vertexAnimation* vat, const char* fileName)
+{
+	FILE* fp = fopen(fileName, "wb");
+	if (fp == NULL)
+	{
+		cout << "VAT: could not open " << fileName << endl;
+		return false;
+	}
+	int header[4] = { 0x31544156, vat->nFrames, vat->nMeshes, vat->frameSize };   //"VAT1"
+	fwrite(header, sizeof(int), 4, fp);
+	fwrite(vat->nVertices, sizeof(int), vat->nMeshes, fp);
+	fwrite(&vat->boundsMin, sizeof(aiVector3D), 1, fp);
+	fwrite(&vat->boundsMax, sizeof(aiVector3D), 1, fp);
+	fwrite(vat->positions, sizeof(unsigned short), 3 * vat->nFrames * vat->frameSize, fp);
+	fwrite(vat->normals, sizeof(signed char), 3 * vat->nFrames * vat->frameSize, fp);
+	fclose(fp);
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Loads a baked clip; fails if it was baked from meshes with other vertex counts
+bool loadVertexAnimation(vertexAnimation* vat, const char* fileName, const aiAnimation* clip,
+	const skinnedMesh* skinData, int nMeshes)
+{
+	FILE* fp = fopen(fileName, "rb");
+	int header[4];
+	if (fp == NULL || fread(header, sizeof(int), 4, fp) != 4 || header[0] != 0x31544156 || header[2] != nMeshes || header[1] <= 0)
+	{
+		cout << "VAT: " << fileName << " is not a vertex animation of this model" << endl;
+		if (fp != NULL) fclose(fp);
+		return false;
+	}
+	allocateVertexAnimation(vat, header[1], nMeshes);
+	vat->clip = clip;
+	vat->frameSize = header[3];
+	vat->bakeTime = 0;
+	bool ok = fread(vat->nVertices, sizeof(int), nMeshes, fp) == nMeshes;
+	long frameSize = 0;           //The frame must be exactly the meshes' vertices: playback indexes it by mesh
+	for (int m = 0; ok && m < nMeshes; m++)
+	{
+		ok = (vat->nVertices[m] == skinData[m].mesh->mNumVertices);
+		frameSize += vat->nVertices[m];
+	}
+	ok = ok && (frameSize == vat->frameSize);
+	size_t n = 3 * (size_t)vat->nFrames * vat->frameSize;
+	long start = ftell(fp);       //The frames must be in the file before they are allocated
+	fseek(fp, 0, SEEK_END);
+	ok = ok && (size_t)(ftell(fp) - start) >= 2 * sizeof(aiVector3D) + n * (sizeof(unsigned short) + sizeof(signed char));
+	fseek(fp, start, SEEK_SET);
+	if (ok)
+	{
+		vat->positions = new unsigned short[n];
+		vat->normals = new signed char[n];
+		ok = fread(&vat->boundsMin, sizeof(aiVector3D), 1, fp) == 1 && fread(&vat->boundsMax, sizeof(aiVector3D), 1, fp) == 1
+			&& fread(vat->positions, sizeof(unsigned short), n, fp) == n && fread(vat->normals, sizeof(signed char), n, fp) == n;
+	}
+	fclose(fp);
+	if (!ok)
+	{
+		cout << "VAT: " << fileName << " does not match this model" << endl;
+		releaseVertexAnimation(vat);
+	}
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+// Prints the size of the baked data and the playback time against live skinning
+// ("liveTime": seconds per frame of updateNodeMatrices() + transformVertices())
+void printVertexAnimationInfo(vertexAnimation* vat, skinnedMesh* skinData, double liveTime)
+{
+	long bytes = (long)vat->nFrames * vat->frameSize * (3 * sizeof(unsigned short) + 3 * sizeof(signed char));
+	long floatBytes = (long)vat->nFrames * vat->frameSize * 6 * sizeof(float);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int nPlays = aisgl_max(vat->nFrames, 100);
+	for (int f = 0; f < nPlays; f++) playVertexAnimation(vat, f % vat->nFrames, skinData);
+	double playTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / nPlays;
+	cout << "VAT: " << vat->nFrames << " frames x " << vat->frameSize << " vertices = " << bytes / 1024 << " KB ("
+		<< 3 * sizeof(unsigned short) + 3 * sizeof(signed char) << " bytes/vertex, float: " << floatBytes / 1024 << " KB)" << endl;
+	cout << "    playback " << 1000 * playTime << " ms/frame, live skinning " << 1000 * liveTime << " ms/frame ("
+		<< (playTime > 0 ? liveTime / playTime : 0) << "x)" << endl;
+}
@@ -0,0 +1,183 @@
+// ----------------------------------------------------------------------------
+// Frame capture helper functions
+//
+// Frames are read back from the display loop without stalling it: glReadPixels
+// targets one of a ring of pixel buffer objects and a fence is placed after it.
+// A PBO is only mapped once its fence has signalled (a few frames later), and
+// its pixels are handed to a background encoder thread that writes them to
+// disk (using the frameOutput functions of offscreen_extras.h). If the GPU or
+// the encoder falls behind, frames are dropped and counted rather than waited
+// for. Requires -pthread.
+//-----------------------------------------------------------------------------
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define CAPTURE_NUM_PBOS 3       //Frames in flight between glReadPixels and mapping
+#define CAPTURE_QUEUE_SIZE 8     //Frames waiting for the encoder thread
+
+struct frameCapture
+{
+	bool active;
+	int width, height;
+	GLuint pbo[CAPTURE_NUM_PBOS];
+	GLsync fence[CAPTURE_NUM_PBOS];     //NULL if the PBO is free
+	int next;                           //Next PBO to read into
+	int nInFlight;
+
+	unsigned char* queue[CAPTURE_QUEUE_SIZE];   //Frame buffers owned by the encoder queue
+	int queueHead, queueCount;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::thread encoder;
+	bool stopping;
+	frameOutput out;
+
+	int nCaptured, nWritten;
+	int nDroppedGpu;          //Dropped because all PBOs were still in flight
+	int nDroppedQueue;        //Dropped because the encoder queue was full
+	int maxQueueDepth;
+	double sumQueueDepth;
+};
+
+// ----------------------------------------------------------------------------
+// Encoder thread: writes queued frames until capture is stopped and the queue is empty
+void captureEncoderLoop(frameCapture* fc)
+{
+	while (true)
+	{
+		unsigned char* frame;
+		{
+			std::unique_lock<std::mutex> guard(fc->lock);
+			fc->wake.wait(guard, [fc] { return fc->queueCount > 0 || fc->stopping; });
+			if (fc->queueCount == 0) return;
+			frame = fc->queue[fc->queueHead];
+		}
+		flipRows(frame, fc->width, fc->height);
+		writeFrame(&fc->out, frame, fc->width, fc->height);
+		{
+			std::lock_guard<std::mutex> guard(fc->lock);
+			fc->queueHead = (fc->queueHead + 1) % CAPTURE_QUEUE_SIZE;
+			fc->queueCount--;
+			fc->nWritten++;
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+bool startCapture(frameCapture* fc, const char* prefix, bool raw, int width, int height)
+{
+	if (!openFrameOutput(&fc->out, prefix, raw)) return false;
+	fc->width = width;
+	fc->height = height;
+	fc->next = fc->nInFlight = 0;
+	fc->queueHead = fc->queueCount = 0;
+	fc->nCaptured = fc->nWritten = fc->nDroppedGpu = fc->nDroppedQueue = fc->maxQueueDepth = 0;
+	fc->sumQueueDepth = 0;
+	fc->stopping = false;
+
+	glGenBuffers(CAPTURE_NUM_PBOS, fc->pbo);
+	for (int i = 0; i < CAPTURE_NUM_PBOS; i++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, fc->pbo[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 3, NULL, GL_STREAM_READ);
+		fc->fence[i] = NULL;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	for (int i = 0; i < CAPTURE_QUEUE_SIZE; i++)
+		fc->queue[i] = new unsigned char[width * height * 3];
+
+	fc->encoder = std::thread(captureEncoderLoop, fc);
+	fc->active = true;
+	cout << "Capture: started (" << width << "x" << height << ")" << endl;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Maps the oldest PBO in flight and queues its pixels for the encoder.
+// Returns false (without mapping) if "wait" is false and its fence is not yet signalled.
+bool retireCapturedFrame(frameCapture* fc, bool wait)
+{
+	int oldest = (fc->next - fc->nInFlight + CAPTURE_NUM_PBOS) % CAPTURE_NUM_PBOS;
+	GLenum status = glClientWaitSync(fc->fence[oldest], 0, wait ? GL_TIMEOUT_IGNORED : 0);
+	if (status == GL_TIMEOUT_EXPIRED) return false;
+	glDeleteSync(fc->fence[oldest]);
+	fc->fence[oldest] = NULL;
+	fc->nInFlight--;
+
+	int size = fc->width * fc->height * 3;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, fc->pbo[oldest]);
+	void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	{
+		std::lock_guard<std::mutex> guard(fc->lock);
+		if (pixels == NULL || fc->queueCount == CAPTURE_QUEUE_SIZE)
+			fc->nDroppedQueue++;
+		else
+		{
+			int tail = (fc->queueHead + fc->queueCount) % CAPTURE_QUEUE_SIZE;
+			memcpy(fc->queue[tail], pixels, size);
+			fc->queueCount++;
+		}
+		if (fc->queueCount > fc->maxQueueDepth) fc->maxQueueDepth = fc->queueCount;
+		fc->sumQueueDepth += fc->queueCount;
+	}
+	fc->wake.notify_one();
+	if (pixels != NULL) glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Call once per frame after drawing, before glutSwapBuffers(). Never blocks on the GPU.
+void captureFrame(frameCapture* fc)
+{
+	if (!fc->active) return;
+	while (fc->nInFlight > 0 && retireCapturedFrame(fc, false));
+
+	fc->nCaptured++;
+	if (fc->nInFlight == CAPTURE_NUM_PBOS)
+	{
+		fc->nDroppedGpu++;
+		return;
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, fc->pbo[fc->next]);
+	glReadPixels(0, 0, fc->width, fc->height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	fc->fence[fc->next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	fc->next = (fc->next + 1) % CAPTURE_NUM_PBOS;
+	fc->nInFlight++;
+}
+
+// ----------------------------------------------------------------------------
+// Number of frames waiting for the encoder thread
+int captureQueueDepth(frameCapture* fc)
+{
+	std::lock_guard<std::mutex> guard(fc->lock);
+	return fc->queueCount;
+}
+
+// ----------------------------------------------------------------------------
+// Flushes the frames in flight, waits for the encoder and prints the statistics
+void stopCapture(frameCapture* fc)
+{
+	if (!fc->active) return;
+	while (fc->nInFlight > 0) retireCapturedFrame(fc, true);
+	{
+		std::lock_guard<std::mutex> guard(fc->lock);
+		fc->stopping = true;
+	}
+	fc->wake.notify_one();
+	fc->encoder.join();
+	fc->active = false;
+
+	glDeleteBuffers(CAPTURE_NUM_PBOS, fc->pbo);
+	for (int i = 0; i < CAPTURE_QUEUE_SIZE; i++) delete[] fc->queue[i];
+	closeFrameOutput(&fc->out, fc->width, fc->height);
+	int nRetired = fc->nCaptured - fc->nDroppedGpu;
+	cout << "Capture: " << fc->nCaptured << " frames, " << fc->nWritten << " written, dropped "
+		<< fc->nDroppedGpu << " (GPU behind) + " << fc->nDroppedQueue << " (encoder behind)"
+		<< ", queue depth mean " << (nRetired > 0 ? fc->sumQueueDepth / nRetired : 0)
+		<< " max " << fc->maxQueueDepth << "/" << CAPTURE_QUEUE_SIZE << endl;
+}
@@ -0,0 +1,402 @@
+// ----------------------------------------------------------------------------
+// GPU skinning helper functions
+//
+// An alternative to skinning on the CPU and sending every vertex through
+// immediate mode: the bind-pose vertices, bone indices and weights of a mesh
+// are uploaded once to static vertex buffers, with one index buffer per level
+// of detail. Each frame only the palette is uploaded, to a uniform buffer: the
+// xcolumns array of the skinnedMesh has the std140 layout of a vec4 array, so
+// it is copied as it is (64 bytes per bone). A GLSL vertex shader blends the
+// palette columns, derives the normal matrices from their cross products (as
+// xformNormalColumns() does) and reproduces the fixed-function lighting of the
+// programs (light 0, colour material, specular, two-sided lighting); the
+// fragment shader modulates by the texture, as GL_MODULATE does.
+//
+// One program is compiled per influence count (1, 2, 4 or 8, the widths of the
+// fixed influence tables): its loop has a constant trip count. Only GLSL 1.30
+// with GL_ARB_uniform_buffer_object is required, so it runs on Mesa's llvmpipe.
+// A mesh with more than 8 weights per vertex, or more bones than the uniform
+// block holds, stays on the CPU path. Only triangles are drawn by the shader.
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define GPU_SKIN_MAX_BONES 1024       //Palette entries in the uniform block (fewer if the implementation's block is smaller)
+#define GPU_SKIN_PROGRAMS 4           //Influence counts 1, 2, 4 and 8
+#define GPU_SKIN_PALETTE_BINDING 0    //Uniform buffer binding point of the palette
+#define GPU_SKIN_TOLERANCE 24         //Image check: largest channel difference of a matching pixel ...
+#define GPU_SKIN_MAX_DIFFERING 0.01   //... and share of pixels allowed to differ more (edges rasterized differently)
+
+//Position at location 0, which the compatibility profile requires for drawing
+enum gpuSkinAttrib { GPU_ATTRIB_POSITION = 0, GPU_ATTRIB_NORMAL, GPU_ATTRIB_BONES0, GPU_ATTRIB_BONES1, GPU_ATTRIB_WEIGHTS0, GPU_ATTRIB_WEIGHTS1 };
+
+struct gpuSkinProgram
+{
+	GLuint program;               //0 until compiled
+	GLint lit, twoSided, textured;   //Uniform locations
+};
+
+struct gpuSkinner
+{
+	bool supported;
+	int maxBones;                 //Palette entries of the uniform block
+	gpuSkinProgram programs[GPU_SKIN_PROGRAMS];
+	size_t paletteBytes;          //Uploaded since the last reset
+	int nUploads;
+};
+
+struct gpuSkinnedMesh
+{
+	bool ready;                   //Drawn by the shader (else by the CPU path)
+	int influences;               //Bone / weight pairs per vertex
+	gpuSkinProgram* program;
+	GLuint vertexBuffer;          //Bind-pose positions, normals, texture coordinates and colours (static)
+	GLuint influenceBuffer;       //Bone indices, then weights (static)
+	GLuint paletteBuffer;         //Palette columns, uploaded before each draw
+	size_t normalOffset, texCoordOffset, colourOffset, weightOffset;
+	int nLevels;
+	GLuint indexBuffer[MAX_LODS]; //Triangles of each level of detail
+	int nIndices[MAX_LODS];
+};
+
+const char* gpuSkinVertexShader =
+	"#extension GL_ARB_uniform_buffer_object : enable\n"
+	"layout(std140) uniform Palette { vec4 palette[4 * MAX_BONES]; };\n"   //Columns: three axes and the origin
+	"in vec3 position;\n"
+	"in vec3 normal;\n"
+	"in ivec4 bones0, bones1;\n"
+	"in vec4 weights0, weights1;\n"
+	"uniform bool lit, twoSided;\n"
+	"vec4 shade(vec3 n, vec3 eye)\n"           //Light 0 with GL_AMBIENT_AND_DIFFUSE colour material, infinite viewer
+	"{\n"
+	"    vec3 l = normalize(gl_LightSource[0].position.xyz - eye * gl_LightSource[0].position.w);\n"
+	"    float d = max(dot(n, l), 0.0);\n"
+	"    vec4 c = (gl_LightModel.ambient + gl_LightSource[0].ambient + d * gl_LightSource[0].diffuse) * gl_Color;\n"
+	"    if (d > 0.0) c += pow(max(dot(n, normalize(l + vec3(0.0, 0.0, 1.0))), 0.0), gl_FrontMaterial.shininess)\n"
+	"        * gl_LightSource[0].specular * gl_FrontMaterial.specular;\n"
+	"    return vec4(clamp(c.rgb, 0.0, 1.0), gl_Color.a);\n"
+	"}\n"
+	"void main()\n"
+	"{\n"
+	"    vec3 p = vec3(0.0), n = vec3(0.0);\n"
+	"    float total = 0.0;\n"
+	"    for (int k = 0; k < INFLUENCES; k++)\n"
+	"    {\n"
+	"        int b = 4 * (k < 4 ? bones0[k & 3] : bones1[k & 3]);\n"
+	"        float w = k < 4 ? weights0[k & 3] : weights1[k & 3];\n"
+	"        vec3 a = palette[b].xyz, c1 = palette[b + 1].xyz, c2 = palette[b + 2].xyz;\n"
+	"        vec3 bc = cross(c1, c2);\n"
+	"        p += w * (a * position.x + c1 * position.y + c2 * position.z + palette[b + 3].xyz);\n"
+	"        n += (w / dot(a, bc)) * (bc * normal.x + cross(c2, a) * normal.y + cross(a, c1) * normal.z);\n"
+	"        total += w;\n"
+	"    }\n"
+	"    if (total == 0.0) { p = position; n = normal; }\n"   //Unweighted: left in bind pose, as on the CPU
+	"    vec4 eye = gl_ModelViewMatrix * vec4(p, 1.0);\n"
+	"    gl_Position = gl_ProjectionMatrix * eye;\n"
+	"    gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+	"    if (lit)\n"
+	"    {\n"
+	"        vec3 en = normalize(gl_NormalMatrix * n);\n"
+	"        gl_FrontColor = shade(en, eye.xyz);\n"
+	"        gl_BackColor = twoSided ? shade(-en, eye.xyz) : gl_FrontColor;\n"
+	"    }\n"
+	"    else gl_FrontColor = gl_BackColor = gl_Color;\n"
+	"}\n";
+
+const char* gpuSkinFragmentShader =
+	"uniform bool textured;\n"
+	"uniform sampler2D tex;\n"
+	"void main()\n"
+	"{\n"
+	"    gl_FragColor = textured ? gl_Color * texture2D(tex, gl_TexCoord[0].st) : gl_Color;\n"
+	"}\n";
+
+// ----------------------------------------------------------------------------
+GLuint compileGpuShader(GLenum type, const char* header, const char* source)
+{
+	const char* sources[2] = { header, source };
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 2, sources, NULL);
+	glCompileShader(shader);
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status)
+	{
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		cout << "GPU skinning: shader compilation failed:" << endl << log << endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+// ----------------------------------------------------------------------------
+// Program for a number of influences per vertex, compiled on first use
+gpuSkinProgram* getGpuSkinProgram(gpuSkinner* gk, int influences)
+{
+	int slot = (influences <= 1) ? 0 : (influences <= 2) ? 1 : (influences <= 4) ? 2 : 3;
+	gpuSkinProgram* gp = &gk->programs[slot];
+	if (gp->program != 0) return gp;
+
+	char header[128];
+	snprintf(header, sizeof(header), "#version 130\n#define INFLUENCES %d\n#define MAX_BONES %d\n", 1 << slot, gk->maxBones);
+	GLuint vs = compileGpuShader(GL_VERTEX_SHADER, header, gpuSkinVertexShader);
+	GLuint fs = compileGpuShader(GL_FRAGMENT_SHADER, "#version 130\n", gpuSkinFragmentShader);
+	if (vs == 0 || fs == 0) return NULL;
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vs);
+	glAttachShader(program, fs);
+	glBindAttribLocation(program, GPU_ATTRIB_POSITION, "position");
+	glBindAttribLocation(program, GPU_ATTRIB_NORMAL, "normal");
+	glBindAttribLocation(program, GPU_ATTRIB_BONES0, "bones0");
+	glBindAttribLocation(program, GPU_ATTRIB_BONES1, "bones1");
+	glBindAttribLocation(program, GPU_ATTRIB_WEIGHTS0, "weights0");
+	glBindAttribLocation(program, GPU_ATTRIB_WEIGHTS1, "weights1");
+	glLinkProgram(program);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status)
+	{
+		char log[1024];
+		glGetProgramInfoLog(program, sizeof(log), NULL, log);
+		cout << "GPU skinning: program link failed:" << endl << log << endl;
+		glDeleteProgram(program);
+		return NULL;
+	}
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Palette"), GPU_SKIN_PALETTE_BINDING);
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "tex"), 0);
+	glUseProgram(0);
+	gp->program = program;
+	gp->lit = glGetUniformLocation(program, "lit");
+	gp->twoSided = glGetUniformLocation(program, "twoSided");
+	gp->textured = glGetUniformLocation(program, "textured");
+	return gp;
+}
+
+// ----------------------------------------------------------------------------
+// Checks that the context can run the shaders (GLSL 1.30 and uniform buffers)
+bool createGpuSkinner(gpuSkinner* gk)
+{
+	for (int i = 0; i < GPU_SKIN_PROGRAMS; i++) gk->programs[i].program = 0;
+	gk->paletteBytes = 0;
+	gk->nUploads = 0;
+	const char* version = (const char*)glGetString(GL_VERSION);
+	const char* renderer = (const char*)glGetString(GL_RENDERER);
+	GLint major = 0, blockSize = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	bool ubo = (major > 3) || (version != NULL && strncmp(version, "3.", 2) == 0 && version[2] >= '1');
+	if (!ubo)
+	{
+		GLint nExtensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &nExtensions);
+		for (int i = 0; i < nExtensions && !ubo; i++)
+			ubo = (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_ARB_uniform_buffer_object") == 0);
+	}
+	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &blockSize);
+	gk->maxBones = aisgl_min(GPU_SKIN_MAX_BONES, blockSize / 64);
+	gk->supported = (major >= 3 && ubo && gk->maxBones > 0);
+	cout << "GPU skinning on " << (renderer != NULL ? renderer : "?") << " (OpenGL " << (version != NULL ? version : "?") << "): ";
+	if (gk->supported) cout << "palette of up to " << gk->maxBones << " bones per mesh" << endl;
+	else cout << "not supported (needs OpenGL 3.0 and uniform buffers)" << endl;
+	return gk->supported;
+}
+
+// ----------------------------------------------------------------------------
+// Uploads the static data of a mesh. Returns false (and the mesh stays on the
+// CPU path) if the shader path cannot draw it.
+bool buildGpuSkinnedMesh(gpuSkinner* gk, gpuSkinnedMesh* gm, const skinnedMesh* sm, const meshLod* lod)
+{
+	const aiMesh* mesh = sm->mesh;
+	int nverts = mesh->mNumVertices;
+	gm->ready = false;
+	gm->nLevels = 0;
+	if (!gk->supported || sm->width == 0 || sm->nBones > gk->maxBones || !sm->normals) return false;
+	gm->influences = aisgl_max(sm->width, 1);
+	gm->program = getGpuSkinProgram(gk, gm->influences);
+	if (gm->program == NULL) return false;
+	int n = gm->influences;
+
+	//Bone / weight table of every vertex: rigid vertices have their bone at full weight, unweighted ones no weight
+	std::vector<int> bones((size_t)nverts * n, 0);
+	std::vector<float> weights((size_t)nverts * n, 0.0f);
+	for (int j = 0; j < sm->nBones; j++)
+		for (int s = sm->rigidStart[j]; s < sm->rigidStart[j + 1]; s++)
+		{
+			int v = sm->rigidVerts[s];
+			for (int k = 0; k < n; k++) bones[v * n + k] = j;
+			weights[v * n] = 1;
+		}
+	for (int j = 0; j < sm->nBones; j++)
+		for (int b = sm->blendStart[j]; b < sm->blendStart[j + 1]; b++)
+		{
+			int v = sm->blendVerts[b];
+			for (int k = 0; k < n; k++)
+			{
+				bones[v * n + k] = sm->fixedBone[v * n + k];
+				weights[v * n + k] = sm->fixedWeight[v * n + k];
+			}
+		}
+
+	size_t vertexBytes = 12 * (size_t)nverts;
+	gm->normalOffset = vertexBytes;
+	gm->texCoordOffset = 2 * vertexBytes;
+	gm->colourOffset = gm->texCoordOffset + (mesh->HasTextureCoords(0) ? vertexBytes : 0);
+	size_t total = gm->colourOffset + (mesh->HasVertexColors(0) ? 16 * (size_t)nverts : 0);
+	glGenBuffers(1, &gm->vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, gm->vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, total, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, vertexBytes, sm->bindVertices);
+	glBufferSubData(GL_ARRAY_BUFFER, gm->normalOffset, vertexBytes, sm->bindNormals);
+	if (mesh->HasTextureCoords(0)) glBufferSubData(GL_ARRAY_BUFFER, gm->texCoordOffset, vertexBytes, mesh->mTextureCoords[0]);
+	if (mesh->HasVertexColors(0)) glBufferSubData(GL_ARRAY_BUFFER, gm->colourOffset, 16 * (size_t)nverts, mesh->mColors[0]);
+
+	gm->weightOffset = bones.size() * sizeof(int);
+	glGenBuffers(1, &gm->influenceBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, gm->influenceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, 2 * gm->weightOffset, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, gm->weightOffset, bones.data());
+	glBufferSubData(GL_ARRAY_BUFFER, gm->weightOffset, gm->weightOffset, weights.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &gm->paletteBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, gm->paletteBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, (size_t)gk->maxBones * sizeof(xcolumns), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	//Triangles of each level (points, lines and polygons are not drawn by the shader path)
+	gm->nLevels = lod->nLods;
+	std::vector<GLuint> indices;
+	glGenBuffers(gm->nLevels, gm->indexBuffer);
+	for (int l = 0; l < gm->nLevels; l++)
+	{
+		indices.clear();
+		for (int k = 0; k < lod->nFaces[l]; k++)
+		{
+			const aiFace* face = &lod->faces[l][k];
+			if (face->mNumIndices != 3) continue;
+			indices.insert(indices.end(), face->mIndices, face->mIndices + 3);
+		}
+		gm->nIndices[l] = indices.size();
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gm->indexBuffer[l]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	gm->ready = true;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+void releaseGpuSkinnedMesh(gpuSkinnedMesh* gm)
+{
+	if (!gm->ready) return;
+	glDeleteBuffers(1, &gm->vertexBuffer);
+	glDeleteBuffers(1, &gm->influenceBuffer);
+	glDeleteBuffers(1, &gm->paletteBuffer);
+	glDeleteBuffers(gm->nLevels, gm->indexBuffer);
+	gm->ready = false;
+}
+
+// ----------------------------------------------------------------------------
+void destroyGpuSkinner(gpuSkinner* gk)
+{
+	for (int i = 0; i < GPU_SKIN_PROGRAMS; i++)
+		if (gk->programs[i].program != 0) glDeleteProgram(gk->programs[i].program);
+	for (int i = 0; i < GPU_SKIN_PROGRAMS; i++) gk->programs[i].program = 0;
+}
+
+// ----------------------------------------------------------------------------
+// Uploads the current palette (updatePalette()) and draws a level of detail
+// with the current matrices, colour, texture and lighting state
+void drawGpuSkinnedMesh(gpuSkinner* gk, const gpuSkinnedMesh* gm, const skinnedMesh* sm, int level, bool twoSided)
+{
+	const aiMesh* mesh = sm->mesh;
+	size_t paletteBytes = sm->nBones * sizeof(xcolumns);
+	glBindBuffer(GL_UNIFORM_BUFFER, gm->paletteBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, paletteBytes, sm->palette);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, GPU_SKIN_PALETTE_BINDING, gm->paletteBuffer);
+	gk->paletteBytes += paletteBytes;
+	gk->nUploads++;
+
+	const gpuSkinProgram* gp = gm->program;
+	glUseProgram(gp->program);
+	glUniform1i(gp->lit, glIsEnabled(GL_LIGHTING));
+	glUniform1i(gp->twoSided, twoSided);
+	glUniform1i(gp->textured, glIsEnabled(GL_TEXTURE_2D) && mesh->HasTextureCoords(0));
+	if (twoSided) glEnable(GL_VERTEX_PROGRAM_TWO_SIDE);
+
+	glBindBuffer(GL_ARRAY_BUFFER, gm->vertexBuffer);
+	glEnableVertexAttribArray(GPU_ATTRIB_POSITION);
+	glVertexAttribPointer(GPU_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glEnableVertexAttribArray(GPU_ATTRIB_NORMAL);
+	glVertexAttribPointer(GPU_ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, 0, (void*)gm->normalOffset);
+	if (mesh->HasTextureCoords(0))
+	{
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(2, GL_FLOAT, sizeof(aiVector3D), (void*)gm->texCoordOffset);
+	}
+	if (mesh->HasVertexColors(0))
+	{
+		glEnableClientState(GL_COLOR_ARRAY);
+		glColorPointer(4, GL_FLOAT, 0, (void*)gm->colourOffset);
+	}
+
+	//Bone / weight pairs: one attribute of up to 4 for the first four, a second one for the next four
+	int n = gm->influences, first = aisgl_min(n, 4);
+	glBindBuffer(GL_ARRAY_BUFFER, gm->influenceBuffer);
+	glEnableVertexAttribArray(GPU_ATTRIB_BONES0);
+	glVertexAttribIPointer(GPU_ATTRIB_BONES0, first, GL_INT, n * sizeof(int), (void*)0);
+	glEnableVertexAttribArray(GPU_ATTRIB_WEIGHTS0);
+	glVertexAttribPointer(GPU_ATTRIB_WEIGHTS0, first, GL_FLOAT, GL_FALSE, n * sizeof(float), (void*)gm->weightOffset);
+	if (n > 4)
+	{
+		glEnableVertexAttribArray(GPU_ATTRIB_BONES1);
+		glVertexAttribIPointer(GPU_ATTRIB_BONES1, 4, GL_INT, n * sizeof(int), (void*)(4 * sizeof(int)));
+		glEnableVertexAttribArray(GPU_ATTRIB_WEIGHTS1);
+		glVertexAttribPointer(GPU_ATTRIB_WEIGHTS1, 4, GL_FLOAT, GL_FALSE, n * sizeof(float), (void*)(gm->weightOffset + 4 * sizeof(float)));
+	}
+
+	level = aisgl_min(level, gm->nLevels - 1);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gm->indexBuffer[level]);
+	glDrawElements(GL_TRIANGLES, gm->nIndices[level], GL_UNSIGNED_INT, (void*)0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDisableVertexAttribArray(GPU_ATTRIB_POSITION);
+	glDisableVertexAttribArray(GPU_ATTRIB_NORMAL);
+	glDisableVertexAttribArray(GPU_ATTRIB_BONES0);
+	glDisableVertexAttribArray(GPU_ATTRIB_WEIGHTS0);
+	glDisableVertexAttribArray(GPU_ATTRIB_BONES1);
+	glDisableVertexAttribArray(GPU_ATTRIB_WEIGHTS1);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
+	if (twoSided) glDisable(GL_VERTEX_PROGRAM_TWO_SIDE);
+	glUseProgram(0);
+}
+
+// ----------------------------------------------------------------------------
+// Compares frames of n pixels drawn with CPU and GPU skinning: they match if
+// few pixels differ by more than GPU_SKIN_TOLERANCE in any channel
+bool checkGpuFrame(const unsigned char* cpu, const unsigned char* gpu, int n)
+{
+	long sum = 0, count = 0;
+	for (int i = 0; i < n; i++)
+	{
+		int d = 0;
+		for (int c = 0; c < 3; c++) d = aisgl_max(d, abs((int)cpu[3 * i + c] - (int)gpu[3 * i + c]));
+		sum += d;
+		if (d > GPU_SKIN_TOLERANCE) count++;
+	}
+	double differing = (n > 0) ? (double)count / n : 0;
+	bool ok = (differing <= GPU_SKIN_MAX_DIFFERING);
+	cout << "Image check: mean difference " << (n > 0 ? (double)sum / n : 0) << ", " << 100 * differing
+		<< "% of the pixels off by more than " << GPU_SKIN_TOLERANCE << (ok ? "" : " (FAILED)") << endl;
+	return ok;
+}
@@ -0,0 +1,119 @@
+// ----------------------------------------------------------------------------
+// Hardware counter helper functions
+//
+// Each thread that reads the counters opens its own group of Linux perf events
+// (user space only, counting that thread): cycles, instructions, L1 data cache
+// read misses, last level cache misses and branch mispredictions. A group is
+// read with one system call; when the kernel multiplexes the counters, the
+// values are scaled by the fraction of time they ran. Events the processor or
+// the kernel settings (perf_event_paranoid, containers) do not allow are left
+// out and reported as unavailable. Memory traffic is estimated from the last
+// level misses, one 64-byte line each; uncore bandwidth counters are
+// system-wide and need privileges, so they are not used.
+//-----------------------------------------------------------------------------
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+#define PERF_EVENTS 5
+#define PERF_LINE_BYTES 64        //Bytes moved per last level cache miss (estimate)
+
+const char* perfEventNames[PERF_EVENTS] = { "cycles", "instructions", "L1D misses", "LLC misses", "branch misses" };
+
+struct perfCounters
+{
+	long long value[PERF_EVENTS];   //-1: not available
+};
+
+struct perfGroup
+{
+	bool opened;
+	int leader;                   //File descriptor of the group leader (-1: no counters)
+	int nEvents;                  //Events in the group, in perfEventNames order
+	int event[PERF_EVENTS];       //Index of each group member in perfEventNames
+};
+
+thread_local perfGroup perfLocal = { false, -1, 0, {} };
+bool perfAvailable[PERF_EVENTS];  //The event could be opened (in any thread)
+bool perfWarned = false;
+
+// ----------------------------------------------------------------------------
+// Opens the calling thread's group (once); returns false if no counter is available
+bool openPerfGroup(perfGroup* pg)
+{
+	if (pg->opened) return pg->leader >= 0;
+	pg->opened = true;
+#ifdef __linux__
+	unsigned int types[PERF_EVENTS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE };
+	unsigned long long configs[PERF_EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+		PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+	for (int e = 0; e < PERF_EVENTS; e++)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = types[e];
+		attr.config = configs[e];
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, pg->leader, 0);
+		if (fd < 0) continue;
+		if (pg->leader < 0) pg->leader = fd;
+		pg->event[pg->nEvents++] = e;
+		perfAvailable[e] = true;
+	}
+#endif
+	if (pg->leader < 0 && !perfWarned)
+	{
+		perfWarned = true;
+		cout << "Perf: hardware counters are not available (see /proc/sys/kernel/perf_event_paranoid)" << endl;
+	}
+	return pg->leader >= 0;
+}
+
+// ----------------------------------------------------------------------------
+// Current counts of the calling thread since its group was opened
+void readPerfCounters(perfCounters* pc)
+{
+	for (int e = 0; e < PERF_EVENTS; e++) pc->value[e] = -1;
+	perfGroup* pg = &perfLocal;
+	if (!openPerfGroup(pg)) return;
+#ifdef __linux__
+	unsigned long long data[3 + PERF_EVENTS];   //Number of events, time enabled, time running, values
+	if (read(pg->leader, data, sizeof(data)) < (ssize_t)(3 * sizeof(unsigned long long))) return;
+	double scale = (data[2] > 0) ? (double)data[1] / data[2] : 1;
+	for (int i = 0; i < pg->nEvents && i < (int)data[0]; i++)
+		pc->value[pg->event[i]] = (long long)(data[3 + i] * scale);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// Prints the counts accumulated by each stage: per frame, per skinned vertex and
+// per evaluated bone (-1: not available). GB/s is the estimated memory traffic.
+void printPerfReport(const char** stageNames, int nStages, const long long (*counts)[PERF_EVENTS], const long long* ns,
+	long nFrames, int nVertices, int nBones)
+{
+	if (nFrames <= 0) return;
+	cout << "Counters over " << nFrames << " frames (" << nVertices << " vertices, " << nBones << " bones per frame):" << endl;
+	printf("    %-10s %12s %6s %10s %10s %10s | %8s %8s %8s | %8s %8s %8s | %8s\n", "stage", "cycles", "IPC", "L1D miss",
+		"LLC miss", "br miss", "cyc/vtx", "L1D/vtx", "LLC/vtx", "cyc/bone", "L1D/bone", "br/bone", "GB/s");
+	for (int s = 0; s < nStages; s++)
+	{
+		const long long* c = counts[s];
+		if (c[0] <= 0) continue;
+		double f[PERF_EVENTS];
+		for (int e = 0; e < PERF_EVENTS; e++) f[e] = perfAvailable[e] ? (double)c[e] / nFrames : -1;
+		printf("    %-10s %12.0f %6.2f %10.0f %10.0f %10.0f | %8.1f %8.2f %8.3f | %8.1f %8.2f %8.2f | %8.2f\n", stageNames[s],
+			f[0], f[1] >= 0 ? f[1] / f[0] : -1, f[2], f[3], f[4],
+			f[0] / aisgl_max(nVertices, 1), f[2] / aisgl_max(nVertices, 1), f[3] / aisgl_max(nVertices, 1),
+			f[0] / aisgl_max(nBones, 1), f[2] / aisgl_max(nBones, 1), f[4] / aisgl_max(nBones, 1),
+			(perfAvailable[3] && ns[s] > 0) ? (double)c[3] * PERF_LINE_BYTES / ns[s] : -1);
+	}
+	fflush(stdout);
+}
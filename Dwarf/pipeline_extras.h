@@ -0,0 +1,231 @@
+// ----------------------------------------------------------------------------
+// Frame pipeline helper functions
+//
+// The animation (sampling and skinning) of frame N+1 runs on a worker thread
+// while the render thread draws frame N. The worker copies each skinned frame
+// (the active vertex prefix of every mesh, with the program's per-frame state)
+// into a slot of a triple buffer and publishes it with one atomic exchange;
+// the renderer takes the newest published slot with another. The worker owns
+// the back slot, the renderer the front slot, and the middle slot changes
+// hands, so neither side ever locks. The worker does not overwrite a frame
+// that has not been taken (it yields instead), so no animation step is lost.
+// The global transformations of the nodes holding meshes are copied into the
+// slot as well, so the renderer never reads a node the worker is animating.
+// When paced, the worker steps once per pipelineTick() (the program's timer
+// stays the animation clock, however often frames are drawn); otherwise it
+// runs as far ahead as the triple buffer allows. There is a single worker:
+// each frame is updated incrementally from the previous one (key cursors,
+// dirty flags, the mesh arrays), so frames cannot be animated in parallel.
+// The slots are allocated from the model's arena and released with it.
+// Requires -pthread.
+//-----------------------------------------------------------------------------
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#define PIPELINE_FRESH 4          //Flag in the middle index: the slot holds a frame not yet taken
+
+struct frameSlot
+{
+	aiVector3D** vertices;        //Skinned vertices and normals of each mesh (active prefix)
+	aiVector3D** normals;
+	aiMatrix4x4* nodeTransforms;  //Global transformation of each mesh node (framePipeline::meshNodes)
+	int lod;                      //Level of detail the frame was skinned at
+	aiVector3D modelPosn;
+	std::chrono::steady_clock::time_point start;   //When the animation of the frame started
+};
+
+struct framePipeline
+{
+	int nMeshes;
+	skinnedMesh* skinData;
+	int nMeshNodes;
+	const aiNode** meshNodes;     //Nodes holding meshes, in drawing order
+	frameSlot slots[3];
+	std::atomic<int> middle;      //Slot index, | PIPELINE_FRESH when published and not yet taken
+	int back, front;              //Owned by the worker and by the renderer
+	bool hasFrame, newFrame;      //The renderer holds a frame / has not presented it yet
+	std::atomic<bool> running;
+	bool paced;                   //Steps only on pipelineTick()
+	std::atomic<int> pendingTicks;   //Ticks of the clock not yet stepped
+	std::atomic<int> requestedLod;   //Chosen by the renderer, applied by the worker
+	void (*animate)(frameSlot*);  //Steps and skins the next frame, filling in the slot's state
+	std::thread worker;
+	long nFrames;                 //Frames presented and their latency (animation start -> presented)
+	double latencySum, latencyMax;
+};
+
+// ----------------------------------------------------------------------------
+// Nodes holding meshes under "node", in drawing order (only counted if "nodes" is NULL)
+int collectMeshNodes(const aiNode* node, const aiNode** nodes, int n)
+{
+	if (node->mNumMeshes > 0)
+	{
+		if (nodes != NULL) nodes[n] = node;
+		n++;
+	}
+	for (int i = 0; i < node->mNumChildren; i++) n = collectMeshNodes(node->mChildren[i], nodes, n);
+	return n;
+}
+
+// ----------------------------------------------------------------------------
+void createFramePipeline(framePipeline* fp, assetArena* arena, skinnedMesh* skinData, int nMeshes, const aiNode* root)
+{
+	fp->nMeshes = nMeshes;
+	fp->skinData = skinData;
+	fp->nMeshNodes = collectMeshNodes(root, NULL, 0);
+	fp->meshNodes = arenaAlloc<const aiNode*>(arena, ARENA_SKINNING, fp->nMeshNodes);
+	collectMeshNodes(root, fp->meshNodes, 0);
+	for (int s = 0; s < 3; s++)
+	{
+		fp->slots[s].vertices = arenaAlloc<aiVector3D*>(arena, ARENA_SKINNING, nMeshes);
+		fp->slots[s].normals = arenaAlloc<aiVector3D*>(arena, ARENA_SKINNING, nMeshes);
+		for (int m = 0; m < nMeshes; m++)
+		{
+			fp->slots[s].vertices[m] = arenaAlloc<aiVector3D>(arena, ARENA_SKINNING, skinData[m].mesh->mNumVertices);
+			fp->slots[s].normals[m] = arenaAlloc<aiVector3D>(arena, ARENA_SKINNING, skinData[m].mesh->mNumVertices);
+		}
+		fp->slots[s].nodeTransforms = arenaAlloc<aiMatrix4x4>(arena, ARENA_SKINNING, fp->nMeshNodes);
+		fp->slots[s].lod = 0;
+	}
+	fp->back = 0;
+	fp->middle = 1;
+	fp->front = 2;
+	fp->hasFrame = fp->newFrame = false;
+	fp->running = false;
+	fp->paced = false;
+	fp->pendingTicks = 0;
+	fp->requestedLod = 0;
+	fp->nFrames = 0;
+	fp->latencySum = fp->latencyMax = 0;
+}
+
+// ----------------------------------------------------------------------------
+// Copies the global transformation of each mesh node into the slot (on the worker, which animates the nodes)
+void storeNodeTransforms(const framePipeline* fp, frameSlot* slot)
+{
+	for (int i = 0; i < fp->nMeshNodes; i++)
+	{
+		const aiNode* node = fp->meshNodes[i];
+		aiMatrix4x4 global = node->mTransformation;
+		for (const aiNode* p = node->mParent; p != NULL; p = p->mParent) global = p->mTransformation * global;
+		slot->nodeTransforms[i] = global;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Global transformation of a mesh node in a published frame (identity for any other node)
+aiMatrix4x4 frameNodeTransform(const framePipeline* fp, const frameSlot* slot, const aiNode* node)
+{
+	for (int i = 0; i < fp->nMeshNodes; i++)
+		if (fp->meshNodes[i] == node) return slot->nodeTransforms[i];
+	return aiMatrix4x4();
+}
+
+// ----------------------------------------------------------------------------
+void pipelineWorker(framePipeline* fp)
+{
+	nameTraceThread("animation");
+	while (fp->running)
+	{
+		if (fp->paced)
+		{
+			traceMark idle = beginTrace("wait for tick");
+			while (fp->running && fp->pendingTicks.load() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			endTrace(idle);
+			if (!fp->running) break;
+			fp->pendingTicks--;
+		}
+		frameSlot* slot = &fp->slots[fp->back];
+		slot->start = std::chrono::steady_clock::now();
+		traceMark animate = beginTrace("animate frame");
+		fp->animate(slot);
+		storeNodeTransforms(fp, slot);
+		for (int m = 0; m < fp->nMeshes; m++)
+		{
+			const skinnedMesh* sm = &fp->skinData[m];
+			std::copy(sm->mesh->mVertices, sm->mesh->mVertices + sm->nActive, slot->vertices[m]);
+			if (sm->normals) std::copy(sm->mesh->mNormals, sm->mesh->mNormals + sm->nActive, slot->normals[m]);
+		}
+		endTrace(animate);
+		traceMark wait = beginTrace("wait for renderer");
+		while (fp->running && (fp->middle.load() & PIPELINE_FRESH)) std::this_thread::yield();
+		endTrace(wait);
+		fp->back = fp->middle.exchange(fp->back | PIPELINE_FRESH) & 3;
+	}
+}
+
+// ----------------------------------------------------------------------------
+void startFramePipeline(framePipeline* fp, void (*animate)(frameSlot*), bool paced)
+{
+	fp->animate = animate;
+	fp->paced = paced;
+	fp->running = true;
+	fp->worker = std::thread(pipelineWorker, fp);
+}
+
+// ----------------------------------------------------------------------------
+// One tick of the animation clock: a paced worker steps once more
+void pipelineTick(framePipeline* fp)
+{
+	fp->pendingTicks++;
+}
+
+// ----------------------------------------------------------------------------
+void stopFramePipeline(framePipeline* fp)
+{
+	if (!fp->running) return;
+	fp->running = false;
+	fp->worker.join();
+}
+
+// ----------------------------------------------------------------------------
+// Takes the newest published frame, waiting for one if "wait" is set; otherwise
+// the last frame taken is returned again. Returns NULL before the first frame.
+const frameSlot* acquireFrame(framePipeline* fp, bool wait)
+{
+	traceMark waiting = beginTrace("wait for frame");
+	while (wait && fp->running && !(fp->middle.load() & PIPELINE_FRESH)) std::this_thread::yield();
+	endTrace(waiting);
+	if (fp->middle.load() & PIPELINE_FRESH)    //Only the renderer clears the flag
+	{
+		fp->front = fp->middle.exchange(fp->front) & 3;
+		fp->hasFrame = fp->newFrame = true;
+	}
+	return fp->hasFrame ? &fp->slots[fp->front] : NULL;
+}
+
+// ----------------------------------------------------------------------------
+// Records the latency of the frame just drawn (once per frame taken)
+void framePresented(framePipeline* fp)
+{
+	if (!fp->newFrame) return;
+	fp->newFrame = false;
+	double latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - fp->slots[fp->front].start).count();
+	fp->nFrames++;
+	fp->latencySum += latency;
+	fp->latencyMax = aisgl_max(fp->latencyMax, latency);
+}
+
+// ----------------------------------------------------------------------------
+// Draws nFrames frames as they are published, without reading them back.
+// Returns the mean time per frame in milliseconds.
+double runPipelinedFrames(framePipeline* fp, int nFrames, void (*draw)(const frameSlot*))
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int f = 0; f < nFrames; f++)
+	{
+		draw(acquireFrame(fp, true));
+		glFinish();
+		framePresented(fp);
+	}
+	return 1000 * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / nFrames;
+}
+
+// ----------------------------------------------------------------------------
+void printPipelineStats(const framePipeline* fp)
+{
+	cout << "Pipeline: " << fp->nFrames << " frames presented, latency (animation start -> presented) mean "
+		<< (fp->nFrames > 0 ? 1000 * fp->latencySum / fp->nFrames : 0) << " ms, max " << 1000 * fp->latencyMax << " ms" << endl;
+}
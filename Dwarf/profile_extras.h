@@ -0,0 +1,268 @@
+// ----------------------------------------------------------------------------
+// Frame profiling helper functions
+//
+// The stages of a frame are bracketed with beginProfile() / endProfile(). The
+// CPU side uses a steady clock; stages submitted on the render thread are also
+// timed on the GPU with timestamp queries, read back PROFILE_LATENCY frames
+// later so that the pipeline never stalls. A stage may be entered several
+// times per frame (once per crowd instance); its times are summed. Completed
+// frames are kept in a window for rolling percentiles, shown on an overlay and
+// written to a CSV log. Timers cost nothing unless the overlay or the log is on.
+// When a timeline trace is being recorded, every stage is also traced. With
+// hardware counters on, each stage also accumulates the counts of the thread
+// that ran it, reported per frame, per vertex and per bone when closing.
+//-----------------------------------------------------------------------------
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+
+#define PROFILE_SAMPLE 0          //Clip sampling (updateNodeMatrices)
+#define PROFILE_HIERARCHY 1       //Global matrices (updateSkeleton)
+#define PROFILE_SKIN 2            //Vertex skinning (skinMesh)
+#define PROFILE_FLOOR 3
+#define PROFILE_SHADOW 4
+#define PROFILE_RENDER 5
+#define PROFILE_SWAP 6
+#define PROFILE_STAGES 7
+#define PROFILE_WINDOW 120        //Frames in the rolling percentiles
+#define PROFILE_LATENCY 3         //Frames between issuing GPU queries and reading them
+#define PROFILE_GPU_SPANS 32      //GPU-timed entries per stage and frame (further entries are CPU-timed only)
+
+const char* profileStageNames[PROFILE_STAGES] = { "sample", "hierarchy", "skin", "floor", "shadow", "render", "swap" };
+const bool profileStageGpu[PROFILE_STAGES] = { false, false, false, true, true, true, true };
+
+struct frameProfiler
+{
+	std::atomic<bool> enabled;   //Read by the animation thread
+	bool hud;
+	FILE* csv;
+	std::atomic<long long> cpuNs[PROFILE_STAGES];   //Current frame (the animation thread may add to it)
+	GLuint queries[PROFILE_LATENCY][PROFILE_STAGES][2 * PROFILE_GPU_SPANS];
+	int nSpans[PROFILE_LATENCY][PROFILE_STAGES];
+	double pendingCpu[PROFILE_LATENCY][PROFILE_STAGES];   //CPU times (ms) of the frames awaiting their GPU times
+	bool pending[PROFILE_LATENCY];
+	int slot;                     //Query slot of the current frame
+	long nFrames;                 //Completed frames
+	double cpu[PROFILE_WINDOW][PROFILE_STAGES];   //Completed frames (ms), ring
+	double gpu[PROFILE_WINDOW][PROFILE_STAGES];
+	bool counters;                //Hardware counters (perf_extras.h)
+	std::atomic<long long> perf[PROFILE_STAGES][PERF_EVENTS];   //Since the profiler was created
+	std::atomic<long long> perfNs[PROFILE_STAGES];
+	long perfFrames;
+	int nVertices, nBones;        //Skinned vertices and evaluated bones per frame, set by the program
+};
+
+struct profileMark
+{
+	int stage;
+	long long t0;                 //-1: not timed
+	int span;                     //GPU span index (-1: none)
+	traceMark trace;
+	perfCounters counts;          //At the start of the stage (if counting)
+};
+
+long long profileNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ----------------------------------------------------------------------------
+// Needs a current GL context. The log (if csvFile is not NULL) gets one row per
+// frame: CPU and GPU time of each stage and their rolling 50th/95th percentiles.
+void createProfiler(frameProfiler* fp, const char* csvFile, bool counters = false)
+{
+	fp->hud = false;
+	fp->csv = NULL;
+	fp->counters = counters && openPerfGroup(&perfLocal);
+	fp->perfFrames = 0;
+	fp->nVertices = fp->nBones = 0;
+	for (int s = 0; s < PROFILE_STAGES; s++)
+	{
+		fp->cpuNs[s] = fp->perfNs[s] = 0;
+		for (int e = 0; e < PERF_EVENTS; e++) fp->perf[s][e] = 0;
+	}
+	for (int k = 0; k < PROFILE_LATENCY; k++)
+	{
+		for (int s = 0; s < PROFILE_STAGES; s++)
+		{
+			fp->nSpans[k][s] = 0;
+			if (profileStageGpu[s]) glGenQueries(2 * PROFILE_GPU_SPANS, fp->queries[k][s]);
+		}
+		fp->pending[k] = false;
+	}
+	fp->slot = 0;
+	fp->nFrames = 0;
+	if (csvFile != NULL)
+	{
+		fp->csv = fopen(csvFile, "w");
+		if (fp->csv == NULL) cout << "Profile: could not open " << csvFile << endl;
+		else
+		{
+			fprintf(fp->csv, "frame,cpu_total_ms");
+			for (int s = 0; s < PROFILE_STAGES; s++)
+			{
+				const char* n = profileStageNames[s];
+				fprintf(fp->csv, ",%s_cpu_ms,%s_gpu_ms,%s_cpu_p50,%s_cpu_p95,%s_gpu_p50,%s_gpu_p95", n, n, n, n, n, n);
+			}
+			fprintf(fp->csv, "\n");
+		}
+	}
+	fp->enabled = (fp->csv != NULL) || fp->counters;
+}
+
+// ----------------------------------------------------------------------------
+profileMark beginProfile(frameProfiler* fp, int stage)
+{
+	profileMark m = { stage, -1, -1, beginTrace(profileStageNames[stage]), {} };
+	if (!fp->enabled) return m;
+	m.t0 = profileNow();
+	if (profileStageGpu[stage] && fp->nSpans[fp->slot][stage] < PROFILE_GPU_SPANS)
+	{
+		m.span = fp->nSpans[fp->slot][stage]++;
+		glQueryCounter(fp->queries[fp->slot][stage][2 * m.span], GL_TIMESTAMP);
+	}
+	if (fp->counters) readPerfCounters(&m.counts);
+	return m;
+}
+
+void endProfile(frameProfiler* fp, profileMark m)
+{
+	endTrace(m.trace);
+	if (m.t0 < 0) return;
+	if (fp->counters)
+	{
+		perfCounters now;
+		readPerfCounters(&now);
+		for (int e = 0; e < PERF_EVENTS; e++)
+			if (now.value[e] >= 0 && m.counts.value[e] >= 0) fp->perf[m.stage][e] += now.value[e] - m.counts.value[e];
+		fp->perfNs[m.stage] += profileNow() - m.t0;
+	}
+	if (m.span >= 0) glQueryCounter(fp->queries[fp->slot][m.stage][2 * m.span + 1], GL_TIMESTAMP);
+	fp->cpuNs[m.stage] += profileNow() - m.t0;
+}
+
+// ----------------------------------------------------------------------------
+// Rolling percentile (0 - 100) of a stage over the completed frames in the window
+double profilePercentile(const frameProfiler* fp, bool gpu, int stage, double p)
+{
+	int n = (int)aisgl_min(fp->nFrames, (long)PROFILE_WINDOW);
+	if (n == 0) return 0;
+	double values[PROFILE_WINDOW];
+	for (int i = 0; i < n; i++) values[i] = gpu ? fp->gpu[i][stage] : fp->cpu[i][stage];
+	int k = aisgl_min((int)(p / 100 * n), n - 1);
+	std::nth_element(values, values + k, values + n);
+	return values[k];
+}
+
+// ----------------------------------------------------------------------------
+// Closes the current frame (call at the start of each frame, on the render
+// thread) and completes the frame issued PROFILE_LATENCY frames ago.
+void profileFrame(frameProfiler* fp)
+{
+	if (!fp->enabled) return;
+	if (fp->counters) fp->perfFrames++;
+	for (int s = 0; s < PROFILE_STAGES; s++) fp->pendingCpu[fp->slot][s] = 1e-6 * fp->cpuNs[s].exchange(0);
+	fp->pending[fp->slot] = true;
+	fp->slot = (fp->slot + 1) % PROFILE_LATENCY;
+	if (!fp->pending[fp->slot]) return;
+
+	int k = fp->slot, w = fp->nFrames % PROFILE_WINDOW;
+	for (int s = 0; s < PROFILE_STAGES; s++)
+	{
+		double gpuMs = 0;
+		for (int i = 0; i < fp->nSpans[k][s]; i++)
+		{
+			GLuint64 t0, t1;
+			glGetQueryObjectui64v(fp->queries[k][s][2 * i], GL_QUERY_RESULT, &t0);
+			glGetQueryObjectui64v(fp->queries[k][s][2 * i + 1], GL_QUERY_RESULT, &t1);
+			gpuMs += 1e-6 * (double)(t1 - t0);
+		}
+		fp->nSpans[k][s] = 0;
+		fp->cpu[w][s] = fp->pendingCpu[k][s];
+		fp->gpu[w][s] = gpuMs;
+	}
+	fp->pending[k] = false;
+	fp->nFrames++;
+
+	if (fp->csv == NULL) return;
+	double total = 0;
+	for (int s = 0; s < PROFILE_STAGES; s++) total += fp->cpu[w][s];
+	fprintf(fp->csv, "%ld,%.4f", fp->nFrames - 1, total);
+	for (int s = 0; s < PROFILE_STAGES; s++)
+		fprintf(fp->csv, ",%.4f,%.4f,%.4f,%.4f,%.4f,%.4f", fp->cpu[w][s], fp->gpu[w][s],
+			profilePercentile(fp, false, s, 50), profilePercentile(fp, false, s, 95),
+			profilePercentile(fp, true, s, 50), profilePercentile(fp, true, s, 95));
+	fprintf(fp->csv, "\n");
+}
+
+// ----------------------------------------------------------------------------
+// Overlay in the top left corner: per stage, the last frame and rolling percentiles (GLUT window only)
+void drawProfileHud(const frameProfiler* fp, int width, int height)
+{
+	if (fp->nFrames == 0) return;
+	int w = (fp->nFrames - 1) % PROFILE_WINDOW;
+	glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_TEXTURE_2D);
+	glDisable(GL_DEPTH_TEST);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(0, width, 0, height, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glColor3f(0, 0, 0);
+	char line[128];
+	int y = height - 16;
+	glRasterPos2i(8, y);
+	glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char*)"stage        cpu   p50   p95 | gpu   p50   p95 (ms)");
+	double total = 0;
+	for (int s = 0; s < PROFILE_STAGES; s++)
+	{
+		total += fp->cpu[w][s];
+		snprintf(line, sizeof(line), "%-10s %5.2f %5.2f %5.2f | %5.2f %5.2f %5.2f", profileStageNames[s], fp->cpu[w][s],
+			profilePercentile(fp, false, s, 50), profilePercentile(fp, false, s, 95), fp->gpu[w][s],
+			profilePercentile(fp, true, s, 50), profilePercentile(fp, true, s, 95));
+		y -= 14;
+		glRasterPos2i(8, y);
+		glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char*)line);
+	}
+	snprintf(line, sizeof(line), "total cpu %.2f ms, frame %ld", total, fp->nFrames - 1);
+	glRasterPos2i(8, y - 14);
+	glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char*)line);
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glPopAttrib();
+}
+
+// ----------------------------------------------------------------------------
+// Prints the rolling percentiles of every stage (and the counters) and closes the log
+void closeProfiler(frameProfiler* fp)
+{
+	if (!fp->enabled) return;
+	if (fp->counters)
+	{
+		long long counts[PROFILE_STAGES][PERF_EVENTS], ns[PROFILE_STAGES];
+		for (int s = 0; s < PROFILE_STAGES; s++)
+		{
+			for (int e = 0; e < PERF_EVENTS; e++) counts[s][e] = fp->perf[s][e];
+			ns[s] = fp->perfNs[s];
+		}
+		printPerfReport(profileStageNames, PROFILE_STAGES, counts, ns, fp->perfFrames, fp->nVertices, fp->nBones);
+		fp->counters = false;
+	}
+	cout << "Profile (last " << aisgl_min(fp->nFrames, (long)PROFILE_WINDOW) << " frames, ms): stage cpu p50/p95, gpu p50/p95" << endl;
+	for (int s = 0; s < PROFILE_STAGES; s++)
+		cout << "    " << profileStageNames[s] << ": " << profilePercentile(fp, false, s, 50) << " / " << profilePercentile(fp, false, s, 95)
+			<< ", " << profilePercentile(fp, true, s, 50) << " / " << profilePercentile(fp, true, s, 95) << endl;
+	if (fp->csv != NULL) fclose(fp->csv);
+	fp->csv = NULL;
+	fp->enabled = fp->hud;
+}
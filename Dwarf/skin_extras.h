@@ -0,0 +1,866 @@
+// ----------------------------------------------------------------------------
+// Skinning helper functions
+//
+// The node tree is flattened into a parent-first array so that global matrices
+// can be updated in one forward pass. Channels write local transformations
+// through setNodeTransform(), which marks a node dirty only if its matrix
+// actually changed; updateSkeleton() propagates dirtiness to the descendants
+// and recomputes only their global matrices. skinMesh() then rebuilds the
+// palette entries of the changed bones and re-skins only the vertices they
+// influence. When nothing changed, nothing is re-skinned.
+//
+// Vertices that follow a single bone (one influence of weight 1, or any vertex
+// when the last bone wins) are partitioned at load into one rigid segment per
+// bone, with their bind-pose data stored contiguously. A segment is transformed
+// by its bone's matrix alone, without the per-weight accumulation; only the
+// remaining vertices take the blended path.
+//
+// Skeleton levels of detail: the nodes are sorted by the skin weight carried by
+// their subtree, parents first, so that each level evaluates a prefix of the
+// node array. A bone whose node is dropped follows its nearest kept ancestor,
+// holding its rest pose relative to it.
+//
+// Each mesh is skinned by kernels chosen at load from its actual weights:
+// blended vertices use fixed-width influence tables of 1, 2, 4 or 8 entries
+// (the smallest that holds every vertex's non-zero weights, padded with zero
+// weights), and meshes without normals use position-only kernels. The widths
+// and attribute sets are template parameters, so the inner loops are unrolled
+// and carry no branches; only a vertex with more than 8 weights falls back to
+// the variable-length loop. Setting skinGenericKernels before the kernels are
+// chosen sends every blended vertex through that loop, as a check on the
+// fixed-width kernels.
+//
+// The skinned vertices are written either to the mesh arrays (floats), or to a
+// compact stream (setSkinOutput()): positions as 16 bits per component within
+// a box holding the animated bounds, normals octahedral-encoded into 2 x 16 or
+// 2 x 8 bits, 10 or 8 bytes per vertex instead of 24. The box is found from the
+// palette: every vertex lies within the sphere that holds its bones' vertices
+// at bind pose, carried by the bone. It only grows (with a margin), and when it
+// does every active vertex is re-encoded.
+//
+// The skeleton and skinning arrays are allocated from the asset's arena. The
+// matrix products and vertex transformations use the SIMD versions of
+// xform_extras.h; palettes are kept by columns, ready for the vertex loops.
+//-----------------------------------------------------------------------------
+
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+
+#define MAX_SKELETON_LODS 4
+
+struct skeleton
+{
+	int nNodes;
+	aiNode** nodes;           //Scene nodes, parents before children
+	int* parent;              //Index of the parent node (-1 for the root)
+	bool* ignored;            //The node's own transformation is not applied
+	aiMatrix4x4* global;      //Node -> model transformation
+	bool* dirty;              //Local transformation changed since the last updateSkeleton()
+	bool* changed;            //Global transformation changed in the last updateSkeleton()
+
+	aiMatrix4x4* rest;        //Local transformation at load
+	float* importance;        //Skin weight carried by the node's subtree (FLT_MAX if it holds meshes)
+	int nActive;              //Nodes 0 .. nActive-1 are evaluated (skeleton level of detail)
+	int nLods;
+	int lodNodes[MAX_SKELETON_LODS];   //Number of nodes kept at each level
+	int* proxy;               //Nearest kept ancestor (or the node itself) at the current level
+	aiMatrix4x4* proxyOffset; //Rest transformation of the node relative to its proxy
+};
+
+#define SKIN_MAX_FIXED_INFLUENCES 8
+#define SKIN_QUANT_MARGIN 0.125f      //Fraction of the extent added on each side when the quantization box grows
+
+enum skinOutput { SKIN_OUTPUT_FLOAT, SKIN_OUTPUT_OCT16, SKIN_OUTPUT_OCT8, SKIN_OUTPUTS };
+const char* skinOutputNames[SKIN_OUTPUTS] = { "float", "16-bit + oct16", "16-bit + oct8" };
+bool skinGenericKernels = false;      //Variable-length loop for every blended vertex (with normals where the mesh has them)
+
+struct skinnedMesh;
+typedef void (*rigidSkinKernel)(skinnedMesh* sm, int bone);     //Active part of a bone's rigid segment
+typedef void (*blendSkinKernel)(skinnedMesh* sm, int nDirty);   //Blended vertices of the dirty list
+
+struct skinnedMesh
+{
+	aiMesh* mesh;
+	aiVector3D* bindVertices;      //Bind-pose positions and normals
+	aiVector3D* bindNormals;
+	bool accumulate;               //Weighted blend of all bones (else the last bone wins, with full weight)
+	bool normals;                  //The mesh has normals to skin
+
+	int nBones;
+	int* boneNode;                 //Skeleton index of each bone (-1 if not in the tree)
+	xcolumns* palette;             //Skinning matrix of each bone (global * offset), by columns
+	xcolumns* normalPalette;       //Inverse transpose of the palette matrix, by columns
+
+	int* infStart;                 //Influences of vertex v: infStart[v] .. infStart[v+1]-1 (in bone order)
+	int* infBone;
+	float* infWeight;
+
+	int* rigidStart;               //Rigid segment of bone j: rigidStart[j] .. rigidStart[j+1]-1
+	int* rigidVerts;               //Vertex index of each rigid segment entry
+	aiVector3D* rigidBindVertices; //Bind-pose positions and normals in segment order
+	aiVector3D* rigidBindNormals;
+	int* blendStart;               //Blended vertices influenced by bone j: blendStart[j] .. blendStart[j+1]-1
+	int* blendVerts;
+	int* rigidEnd;                 //End of the active part (level of detail) of each rigid segment
+	int* blendEnd;                 //... and of each bone's blended vertices
+
+	int maxInfluences;             //Most non-zero weights of a blended vertex
+	int width;                     //Entries per vertex in the fixed-width tables (0: variable, from infStart)
+	int* fixedBone;                //Influences of blended vertex v: [v * width, (v + 1) * width), zero weights pad
+	float* fixedWeight;
+	rigidSkinKernel skinRigid;     //Kernels chosen at load
+	blendSkinKernel skinBlended;
+	const char* kernelName;
+
+	int output;                    //Format of the skinned vertices (skinOutput)
+	unsigned short* quantPositions;   //Quantized stream: 3 x 16 bits per vertex, relative to the box
+	short* quantNormals16;         //Octahedral normals, 2 x 16 bits (SKIN_OUTPUT_OCT16) ...
+	signed char* quantNormals8;    //... or 2 x 8 bits (SKIN_OUTPUT_OCT8)
+	aiVector3D quantMin, quantMax; //Quantization box (empty until the first pass)
+	aiVector3D quantScale, quantStep;   //65535 / extent and its inverse, per axis
+	aiVector3D* boneCentre;        //Bind-pose sphere of the vertices of each bone (radius < 0: no vertex)
+	float* boneRadius;
+	int nRequantized;              //Passes in which the box grew
+
+	int nActive;                   //Only vertices 0 .. nActive-1 are skinned (level of detail)
+	int* stamp;                    //Last skinMesh() pass in which the vertex was re-skinned
+	int pass;
+	int* dirtyList;                //Vertices to re-skin in the current pass
+	bool* boneChanged;             //Palette entry rebuilt in the current pass
+};
+
+// ----------------------------------------------------------------------------
+void addSkeletonNodes(skeleton* skel, aiNode* nd, int parent, const char* ignoredNode)
+{
+	int index = skel->nNodes++;
+	skel->nodes[index] = nd;
+	skel->parent[index] = parent;
+	skel->ignored[index] = (ignoredNode != NULL && nd->mName == aiString(ignoredNode));
+	for (int i = 0; i < nd->mNumChildren; i++)
+		addSkeletonNodes(skel, nd->mChildren[i], index, ignoredNode);
+}
+
+int countNodes(const aiNode* nd)
+{
+	int n = 1;
+	for (int i = 0; i < nd->mNumChildren; i++) n += countNodes(nd->mChildren[i]);
+	return n;
+}
+
+// ----------------------------------------------------------------------------
+// As in the original parent walk, the root's own transformation is not applied.
+void buildSkeleton(skeleton* skel, assetArena* arena, aiNode* root, const char* ignoredNode = NULL)
+{
+	int n = countNodes(root);
+	skel->nNodes = 0;
+	skel->nodes = arenaAlloc<aiNode*>(arena, ARENA_SKELETON, n);
+	skel->parent = arenaAlloc<int>(arena, ARENA_SKELETON, n);
+	skel->ignored = arenaAlloc<bool>(arena, ARENA_SKELETON, n);
+	skel->global = arenaAlloc<aiMatrix4x4>(arena, ARENA_SKELETON, n);
+	skel->dirty = arenaAlloc<bool>(arena, ARENA_SKELETON, n);
+	skel->changed = arenaAlloc<bool>(arena, ARENA_SKELETON, n);
+	addSkeletonNodes(skel, root, -1, ignoredNode);
+	skel->ignored[0] = true;
+	for (int i = 0; i < n; i++) skel->dirty[i] = true;
+
+	skel->rest = arenaAlloc<aiMatrix4x4>(arena, ARENA_SKELETON, n);
+	skel->importance = arenaAlloc<float>(arena, ARENA_SKELETON, n);
+	skel->proxy = arenaAlloc<int>(arena, ARENA_SKELETON, n);
+	skel->proxyOffset = arenaAlloc<aiMatrix4x4>(arena, ARENA_SKELETON, n);
+	for (int i = 0; i < n; i++)
+	{
+		skel->rest[i] = skel->nodes[i]->mTransformation;
+		skel->importance[i] = FLT_MAX;
+		skel->proxy[i] = i;
+	}
+	skel->nActive = n;
+	skel->nLods = 1;
+	skel->lodNodes[0] = n;
+}
+
+// ----------------------------------------------------------------------------
+int findSkeletonNode(const skeleton* skel, const aiString& name)
+{
+	for (int i = 0; i < skel->nNodes; i++)
+		if (skel->nodes[i]->mName == name) return i;
+	return -1;
+}
+
+// ----------------------------------------------------------------------------
+// Sets the local transformation of a node; returns true if it changed
+bool setNodeTransform(skeleton* skel, int index, const aiMatrix4x4& m)
+{
+	if (index < 0 || skel->nodes[index]->mTransformation == m) return false;
+	skel->nodes[index]->mTransformation = m;
+	skel->dirty[index] = true;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Recomputes the global matrices of dirty nodes and their descendants.
+// Returns the number of nodes whose global matrix changed.
+int updateSkeleton(skeleton* skel)
+{
+	int nChanged = 0;
+	for (int i = 0; i < skel->nActive; i++)
+	{
+		int p = skel->parent[i];
+		skel->changed[i] = skel->dirty[i] || (p >= 0 && skel->changed[p]);
+		skel->dirty[i] = false;
+		if (!skel->changed[i]) continue;
+
+		if (p < 0) skel->global[i] = skel->ignored[i] ? aiMatrix4x4() : skel->nodes[i]->mTransformation;
+		else if (skel->ignored[i]) skel->global[i] = skel->global[p];
+		else xformStore(xformMul(xformLoad(skel->global[p]), xformLoad(skel->nodes[i]->mTransformation)), skel->global[i]);
+		nChanged++;
+	}
+	return nChanged;
+}
+
+// ----------------------------------------------------------------------------
+// Sorts the nodes by importance (the total bone weight of the meshes' vertices
+// on the node's subtree) and builds the skeleton levels of detail: level 1
+// drops nodes that move no vertex (end sites, unused bones), levels 2 and 3
+// drop subtrees carrying less than 1% and 4% of the total weight. Nodes holding
+// meshes are always kept. Must be called before any skeleton index is stored.
+void sortSkeletonByImportance(skeleton* skel, const aiScene* meshScene)
+{
+	int n = skel->nNodes;
+	float total = 0;
+	for (int i = 0; i < n; i++) skel->importance[i] = (skel->nodes[i]->mNumMeshes > 0) ? FLT_MAX : 0;
+	for (int m = 0; m < meshScene->mNumMeshes; m++)
+	{
+		const aiMesh* mesh = meshScene->mMeshes[m];
+		for (int j = 0; j < mesh->mNumBones; j++)
+		{
+			int node = findSkeletonNode(skel, mesh->mBones[j]->mName);
+			if (node < 0) continue;
+			for (int k = 0; k < mesh->mBones[j]->mNumWeights; k++)
+			{
+				float w = mesh->mBones[j]->mWeights[k].mWeight;
+				if (skel->importance[node] < FLT_MAX) skel->importance[node] += w;
+				total += w;
+			}
+		}
+	}
+	for (int i = n - 1; i > 0; i--)     //Children follow their parents
+	{
+		float& parent = skel->importance[skel->parent[i]];
+		parent = (parent == FLT_MAX || skel->importance[i] == FLT_MAX) ? FLT_MAX : parent + skel->importance[i];
+	}
+
+	//A parent is at least as important as its children, so ties broken by index keep parents first
+	int* order = new int[n];
+	for (int i = 0; i < n; i++) order[i] = i;
+	const float* importance = skel->importance;
+	std::stable_sort(order, order + n, [importance](int a, int b) { return importance[a] > importance[b]; });
+	int* newIndex = new int[n];
+	for (int i = 0; i < n; i++) newIndex[order[i]] = i;
+
+	//Permuted in place (the arrays live in the arena), from copies of the old order
+	std::vector<aiNode*> nodes(skel->nodes, skel->nodes + n);
+	std::vector<int> parent(skel->parent, skel->parent + n);
+	std::vector<char> ignored(skel->ignored, skel->ignored + n);
+	std::vector<aiMatrix4x4> rest(skel->rest, skel->rest + n);
+	std::vector<float> imp(skel->importance, skel->importance + n);
+	for (int i = 0; i < n; i++)
+	{
+		int old = order[i];
+		skel->nodes[i] = nodes[old];
+		skel->parent[i] = (parent[old] >= 0) ? newIndex[parent[old]] : -1;
+		skel->ignored[i] = ignored[old];
+		skel->rest[i] = rest[old];
+		skel->importance[i] = imp[old];
+	}
+	delete[] order;
+	delete[] newIndex;
+
+	const float threshold[MAX_SKELETON_LODS] = { -1, 0, 0.01f * total, 0.04f * total };
+	skel->nLods = 0;
+	for (int l = 0; l < MAX_SKELETON_LODS; l++)
+	{
+		int count = 0;
+		while (count < n && skel->importance[count] > threshold[l]) count++;
+		if (count == 0) count = 1;
+		if (l > 0 && count == skel->lodNodes[l - 1]) break;
+		skel->lodNodes[skel->nLods++] = count;
+	}
+	skel->nActive = n;
+}
+
+// ----------------------------------------------------------------------------
+// Selects a skeleton level (clamped to the levels available). Returns true if
+// the number of evaluated nodes changed, in which case every palette is rebuilt
+// at the next update.
+bool setSkeletonLod(skeleton* skel, int level)
+{
+	level = aisgl_min(aisgl_max(level, 0), skel->nLods - 1);
+	int nActive = skel->lodNodes[level];
+	if (nActive == skel->nActive) return false;
+	skel->nActive = nActive;
+	for (int i = 0; i < skel->nNodes; i++)
+	{
+		int p = skel->parent[i];
+		if (i < nActive)
+		{
+			skel->proxy[i] = i;
+			skel->proxyOffset[i] = aiMatrix4x4();
+			skel->dirty[i] = true;
+		}
+		else
+		{
+			skel->proxy[i] = skel->proxy[p];
+			skel->proxyOffset[i] = skel->ignored[i] ? skel->proxyOffset[p] : skel->proxyOffset[p] * skel->rest[i];
+		}
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+void printSkeletonLods(const skeleton* skel)
+{
+	cout << "Skeleton LODs:";
+	for (int l = 0; l < skel->nLods; l++) cout << "  [" << l << "] " << skel->lodNodes[l] << " nodes";
+	cout << endl;
+}
+
+// ----------------------------------------------------------------------------
+// Quantized output: positions as 16 bits per component within the box quantMin
+// .. quantMax, normals octahedral-encoded into two signed 16 or 8 bit values
+inline void quantizePosition(unsigned short* q, xvec p, xvec qMin, xvec qScale)
+{
+	float f[4];
+	xstore(f, xmin(xmax(xmul(xsub(p, qMin), qScale), xzero()), xsplat(65535.0f)));
+	for (int i = 0; i < 3; i++) q[i] = (unsigned short)(f[i] + 0.5f);
+}
+
+// Octahedral coordinates of a (not necessarily unit) normal, in [-1, 1]
+inline void octEncode(xvec n, float& u, float& v)
+{
+	float f[4];
+	xstore(f, n);
+	float l1 = fabsf(f[0]) + fabsf(f[1]) + fabsf(f[2]);
+	if (l1 == 0) { u = v = 0; return; }
+	u = f[0] / l1;
+	v = f[1] / l1;
+	if (f[2] < 0)       //Lower hemisphere: folded over the diagonals
+	{
+		float fu = (1 - fabsf(v)) * (u < 0 ? -1 : 1);
+		v = (1 - fabsf(u)) * (v < 0 ? -1 : 1);
+		u = fu;
+	}
+}
+
+template <class T, int MAXQ> inline void octQuantize(T* q, xvec n)
+{
+	float u, v;
+	octEncode(n, u, v);
+	q[0] = (T)lrintf(u * MAXQ);
+	q[1] = (T)lrintf(v * MAXQ);
+}
+
+inline aiVector3D octDecode(float u, float v)
+{
+	aiVector3D n(u, v, 1 - fabsf(u) - fabsf(v));
+	if (n.z < 0)
+	{
+		n.x = (1 - fabsf(v)) * (u < 0 ? -1 : 1);
+		n.y = (1 - fabsf(u)) * (v < 0 ? -1 : 1);
+	}
+	return n.Normalize();
+}
+
+// ----------------------------------------------------------------------------
+// Skinning kernels. The influence count N, the attribute set and the output
+// format are template parameters: the loops over the N influences unroll, the
+// position-only instances carry no normal code at all, and each output format
+// is written in place by the kernel.
+template <bool NORMALS, int OUTPUT> inline void storeSkinnedVertex(skinnedMesh* sm, int v, xvec posn, xvec norm, xvec qMin, xvec qScale)
+{
+	if (OUTPUT == SKIN_OUTPUT_FLOAT)
+	{
+		xstore3(&sm->mesh->mVertices[v].x, posn);
+		if (NORMALS) xstore3(&sm->mesh->mNormals[v].x, norm);
+		return;
+	}
+	quantizePosition(sm->quantPositions + 3 * v, posn, qMin, qScale);
+	if (NORMALS && OUTPUT == SKIN_OUTPUT_OCT16) octQuantize<short, 32767>(sm->quantNormals16 + 2 * v, norm);
+	if (NORMALS && OUTPUT == SKIN_OUTPUT_OCT8) octQuantize<signed char, 127>(sm->quantNormals8 + 2 * v, norm);
+}
+
+// Active part of the rigid segment of bone j: one matrix, no weights
+template <bool NORMALS, int OUTPUT> void skinRigidSegment(skinnedMesh* sm, int j)
+{
+	const xcolumns& m = sm->palette[j];
+	const xcolumns& nm = sm->normalPalette[j];
+	xvec qMin = xload3(sm->quantMin), qScale = xload3(sm->quantScale);
+	for (int s = sm->rigidStart[j]; s < sm->rigidEnd[j]; s++)
+	{
+		xvec posn = xformPoint(m, xload3(sm->rigidBindVertices[s]));
+		xvec norm = NORMALS ? xformDirection(nm, xload3(sm->rigidBindNormals[s])) : xzero();
+		storeSkinnedVertex<NORMALS, OUTPUT>(sm, sm->rigidVerts[s], posn, norm, qMin, qScale);
+	}
+}
+
+// Blended vertices with at most N influences, from the fixed-width tables
+template <int N, bool NORMALS, int OUTPUT> void skinBlendedVertices(skinnedMesh* sm, int nDirty)
+{
+	xvec qMin = xload3(sm->quantMin), qScale = xload3(sm->quantScale);
+	for (int d = 0; d < nDirty; d++)
+	{
+		int v = sm->dirtyList[d];
+		const int* bone = sm->fixedBone + v * N;
+		const float* weight = sm->fixedWeight + v * N;
+		xvec bindPosn = xload3(sm->bindVertices[v]);
+		xvec bindNorm = NORMALS ? xload3(sm->bindNormals[v]) : xzero();
+		xvec w = xsplat(weight[0]);
+		xvec posn = xmul(xformPoint(sm->palette[bone[0]], bindPosn), w);
+		xvec norm = NORMALS ? xmul(xformDirection(sm->normalPalette[bone[0]], bindNorm), w) : xzero();
+		for (int k = 1; k < N; k++)
+		{
+			w = xsplat(weight[k]);
+			posn = xmadd(xformPoint(sm->palette[bone[k]], bindPosn), w, posn);
+			if (NORMALS) norm = xmadd(xformDirection(sm->normalPalette[bone[k]], bindNorm), w, norm);
+		}
+		storeSkinnedVertex<NORMALS, OUTPUT>(sm, v, posn, norm, qMin, qScale);
+	}
+}
+
+// Blended vertices with any number of influences, from the variable-length table
+template <bool NORMALS, int OUTPUT> void skinBlendedGeneric(skinnedMesh* sm, int nDirty)
+{
+	xvec qMin = xload3(sm->quantMin), qScale = xload3(sm->quantScale);
+	for (int d = 0; d < nDirty; d++)
+	{
+		int v = sm->dirtyList[d];
+		xvec bindPosn = xload3(sm->bindVertices[v]);
+		xvec bindNorm = NORMALS ? xload3(sm->bindNormals[v]) : xzero();
+		xvec posn = xzero(), norm = xzero();
+		for (int k = sm->infStart[v]; k < sm->infStart[v + 1]; k++)
+		{
+			int b = sm->infBone[k];
+			xvec w = xsplat(sm->infWeight[k]);
+			posn = xmadd(xformPoint(sm->palette[b], bindPosn), w, posn);
+			if (NORMALS) norm = xmadd(xformDirection(sm->normalPalette[b], bindNorm), w, norm);
+		}
+		storeSkinnedVertex<NORMALS, OUTPUT>(sm, v, posn, norm, qMin, qScale);
+	}
+}
+
+template <bool NORMALS, int OUTPUT> void pickSkinKernels(skinnedMesh* sm)
+{
+	sm->skinRigid = skinRigidSegment<NORMALS, OUTPUT>;
+	switch (skinGenericKernels ? 0 : sm->width)
+	{
+	case 1: sm->skinBlended = skinBlendedVertices<1, NORMALS, OUTPUT>; break;
+	case 2: sm->skinBlended = skinBlendedVertices<2, NORMALS, OUTPUT>; break;
+	case 4: sm->skinBlended = skinBlendedVertices<4, NORMALS, OUTPUT>; break;
+	case 8: sm->skinBlended = skinBlendedVertices<8, NORMALS, OUTPUT>; break;
+	default: sm->skinBlended = skinBlendedGeneric<NORMALS, OUTPUT>; break;
+	}
+}
+
+template <bool NORMALS> void pickOutputKernels(skinnedMesh* sm)
+{
+	switch (sm->output)
+	{
+	case SKIN_OUTPUT_OCT16: pickSkinKernels<NORMALS, SKIN_OUTPUT_OCT16>(sm); break;
+	case SKIN_OUTPUT_OCT8: pickSkinKernels<NORMALS, SKIN_OUTPUT_OCT8>(sm); break;
+	default: pickSkinKernels<NORMALS, SKIN_OUTPUT_FLOAT>(sm); break;
+	}
+}
+
+void chooseSkinKernels(skinnedMesh* sm)
+{
+	if (sm->normals) pickOutputKernels<true>(sm);
+	else pickOutputKernels<false>(sm);
+}
+
+// ----------------------------------------------------------------------------
+// Builds the fixed-width influence tables of the blended vertices (rigidBone[v]
+// < 0 and weighted) and picks the kernels for the mesh: the smallest width
+// holding every blended vertex's non-zero weights, the variable-length loop
+// beyond SKIN_MAX_FIXED_INFLUENCES, and normals only if the mesh has them.
+void selectSkinKernels(skinnedMesh* sm, assetArena* arena, const int* rigidBone)
+{
+	int nverts = sm->mesh->mNumVertices;
+	sm->maxInfluences = 0;
+	for (int v = 0; v < nverts; v++)
+	{
+		if (rigidBone[v] >= 0) continue;
+		int count = 0;
+		for (int k = sm->infStart[v]; k < sm->infStart[v + 1]; k++)
+			if (sm->infWeight[k] != 0.0f) count++;
+		sm->maxInfluences = aisgl_max(sm->maxInfluences, count);
+	}
+
+	sm->width = 1;
+	while (sm->width < sm->maxInfluences) sm->width *= 2;
+	if (sm->width > SKIN_MAX_FIXED_INFLUENCES) sm->width = 0;
+	sm->fixedBone = NULL;
+	sm->fixedWeight = NULL;
+	if (sm->width > 0 && sm->maxInfluences > 0)
+	{
+		int w = sm->width;
+		sm->fixedBone = arenaAlloc<int>(arena, ARENA_WEIGHTS, nverts * w);
+		sm->fixedWeight = arenaAlloc<float>(arena, ARENA_WEIGHTS, nverts * w);
+		for (int v = 0; v < nverts; v++)
+		{
+			int first = sm->infStart[v], last = sm->infStart[v + 1];
+			if (rigidBone[v] >= 0 || last == first) continue;
+			int n = 0;
+			for (int k = first; k < last; k++)
+			{
+				if (sm->infWeight[k] == 0.0f) continue;
+				sm->fixedBone[v * w + n] = sm->infBone[k];
+				sm->fixedWeight[v * w + n] = sm->infWeight[k];
+				n++;
+			}
+			for (; n < w; n++)           //Padding: a bone already fetched, with no weight
+			{
+				sm->fixedBone[v * w + n] = sm->infBone[last - 1];
+				sm->fixedWeight[v * w + n] = 0;
+			}
+		}
+	}
+
+	const char* widthNames[SKIN_MAX_FIXED_INFLUENCES + 1] = { "variable", "1", "2", "", "4", "", "", "", "8" };
+	sm->kernelName = widthNames[sm->width];
+	chooseSkinKernels(sm);
+}
+
+// ----------------------------------------------------------------------------
+// Ends of the active parts of the rigid segments and blended vertex lists
+// (both are in vertex order)
+void updateActiveEnds(skinnedMesh* sm)
+{
+	for (int j = 0; j < sm->nBones; j++)
+	{
+		sm->rigidEnd[j] = std::lower_bound(sm->rigidVerts + sm->rigidStart[j], sm->rigidVerts + sm->rigidStart[j + 1], sm->nActive) - sm->rigidVerts;
+		sm->blendEnd[j] = std::lower_bound(sm->blendVerts + sm->blendStart[j], sm->blendVerts + sm->blendStart[j + 1], sm->nActive) - sm->blendVerts;
+	}
+}
+
+// ----------------------------------------------------------------------------
+void buildSkinnedMesh(skinnedMesh* sm, assetArena* arena, aiMesh* mesh, const skeleton* skel,
+	aiVector3D* bindVertices, aiVector3D* bindNormals, bool accumulate)
+{
+	int nverts = mesh->mNumVertices;
+	sm->mesh = mesh;
+	sm->bindVertices = bindVertices;
+	sm->bindNormals = bindNormals;
+	sm->accumulate = accumulate;
+	sm->normals = (bindNormals != NULL);
+	sm->nBones = mesh->mNumBones;
+	sm->boneNode = arenaAlloc<int>(arena, ARENA_WEIGHTS, sm->nBones);
+	sm->palette = arenaAlloc<xcolumns>(arena, ARENA_SKINNING, sm->nBones);
+	sm->normalPalette = arenaAlloc<xcolumns>(arena, ARENA_SKINNING, sm->nBones);
+
+	//Vertex -> influence table, built by counting then filling in bone order
+	sm->infStart = arenaAlloc<int>(arena, ARENA_WEIGHTS, nverts + 1);
+	for (int v = 0; v <= nverts; v++) sm->infStart[v] = 0;
+	for (int j = 0; j < sm->nBones; j++)
+	{
+		aiBone* bone = mesh->mBones[j];
+		sm->boneNode[j] = findSkeletonNode(skel, bone->mName);
+		for (int k = 0; k < bone->mNumWeights; k++) sm->infStart[bone->mWeights[k].mVertexId + 1]++;
+	}
+	for (int v = 0; v < nverts; v++) sm->infStart[v + 1] += sm->infStart[v];
+	sm->infBone = arenaAlloc<int>(arena, ARENA_WEIGHTS, sm->infStart[nverts]);
+	sm->infWeight = arenaAlloc<float>(arena, ARENA_WEIGHTS, sm->infStart[nverts]);
+	int* fill = new int[nverts];
+	for (int v = 0; v < nverts; v++) fill[v] = sm->infStart[v];
+	for (int j = 0; j < sm->nBones; j++)
+	{
+		aiBone* bone = mesh->mBones[j];
+		for (int k = 0; k < bone->mNumWeights; k++)
+		{
+			int v = bone->mWeights[k].mVertexId;
+			sm->infBone[fill[v]] = j;
+			sm->infWeight[fill[v]] = bone->mWeights[k].mWeight;
+			fill[v]++;
+		}
+	}
+	delete[] fill;
+
+	//Partition: rigidBone[v] is the only bone moving vertex v, or -1 if it is blended (or unweighted)
+	int* rigidBone = new int[nverts];
+	sm->rigidStart = arenaAlloc<int>(arena, ARENA_WEIGHTS, sm->nBones + 1);
+	sm->blendStart = arenaAlloc<int>(arena, ARENA_WEIGHTS, sm->nBones + 1);
+	for (int j = 0; j <= sm->nBones; j++) sm->rigidStart[j] = sm->blendStart[j] = 0;
+	for (int v = 0; v < nverts; v++)
+	{
+		int first = sm->infStart[v], last = sm->infStart[v + 1];
+		rigidBone[v] = -1;
+		if (last == first) continue;
+		if (!accumulate || (last - first == 1 && fabs(sm->infWeight[first] - 1.0f) < 1e-4f))
+		{
+			rigidBone[v] = sm->infBone[last - 1];
+			sm->rigidStart[rigidBone[v] + 1]++;
+		}
+		else
+			for (int k = first; k < last; k++) sm->blendStart[sm->infBone[k] + 1]++;
+	}
+	for (int j = 0; j < sm->nBones; j++)
+	{
+		sm->rigidStart[j + 1] += sm->rigidStart[j];
+		sm->blendStart[j + 1] += sm->blendStart[j];
+	}
+	int nRigid = sm->rigidStart[sm->nBones];
+	sm->rigidVerts = arenaAlloc<int>(arena, ARENA_WEIGHTS, nRigid);
+	sm->rigidBindVertices = arenaAlloc<aiVector3D>(arena, ARENA_BIND_POSE, nRigid);
+	sm->rigidBindNormals = sm->normals ? arenaAlloc<aiVector3D>(arena, ARENA_BIND_POSE, nRigid) : NULL;
+	sm->blendVerts = arenaAlloc<int>(arena, ARENA_WEIGHTS, sm->blendStart[sm->nBones]);
+	int* rigidFill = new int[sm->nBones];
+	int* blendFill = new int[sm->nBones];
+	for (int j = 0; j < sm->nBones; j++)
+	{
+		rigidFill[j] = sm->rigidStart[j];
+		blendFill[j] = sm->blendStart[j];
+	}
+	for (int v = 0; v < nverts; v++)
+	{
+		if (rigidBone[v] >= 0)
+		{
+			int s = rigidFill[rigidBone[v]]++;
+			sm->rigidVerts[s] = v;
+			sm->rigidBindVertices[s] = bindVertices[v];
+			if (sm->normals) sm->rigidBindNormals[s] = bindNormals[v];
+		}
+		else
+			for (int k = sm->infStart[v]; k < sm->infStart[v + 1]; k++)
+				sm->blendVerts[blendFill[sm->infBone[k]]++] = v;
+	}
+	sm->output = SKIN_OUTPUT_FLOAT;
+	sm->quantPositions = NULL;
+	sm->quantNormals16 = NULL;
+	sm->quantNormals8 = NULL;
+	sm->boneCentre = NULL;
+	sm->boneRadius = NULL;
+	sm->quantMin = sm->quantMax = sm->quantScale = sm->quantStep = aiVector3D(0, 0, 0);
+	sm->nRequantized = 0;
+	selectSkinKernels(sm, arena, rigidBone);
+	delete[] rigidBone;
+	delete[] rigidFill;
+	delete[] blendFill;
+
+	sm->nActive = nverts;
+	sm->rigidEnd = arenaAlloc<int>(arena, ARENA_SKINNING, sm->nBones);
+	sm->blendEnd = arenaAlloc<int>(arena, ARENA_SKINNING, sm->nBones);
+	updateActiveEnds(sm);
+	sm->stamp = arenaAlloc<int>(arena, ARENA_SKINNING, nverts);
+	sm->pass = 0;
+	sm->dirtyList = arenaAlloc<int>(arena, ARENA_SKINNING, nverts);
+	sm->boneChanged = arenaAlloc<bool>(arena, ARENA_SKINNING, sm->nBones);
+}
+
+// ----------------------------------------------------------------------------
+// Forces the next updateSkeleton() / skinMesh() to recompute every node and
+// vertex, e.g. after the mesh arrays were overwritten by other means
+void markSkeletonDirty(skeleton* skel)
+{
+	for (int i = 0; i < skel->nNodes; i++) skel->dirty[i] = true;
+}
+
+// ----------------------------------------------------------------------------
+// Bounds of the skinned vertices under the current palette: the union of the
+// bones' spheres, each scaled by its palette's longest axis (exact for
+// rotations and scales; a sheared palette may clamp a few vertices). If they
+// leave the quantization box, the box grows to hold them with a margin and
+// true is returned.
+bool growQuantBox(skinnedMesh* sm)
+{
+	xvec lo = xsplat(FLT_MAX), hi = xsplat(-FLT_MAX);
+	for (int j = 0; j < sm->nBones; j++)
+	{
+		if (sm->boneNode[j] < 0 || sm->boneRadius[j] < 0) continue;
+		const xcolumns& m = sm->palette[j];
+		xvec axes = xmax(xmax(xdot3(m.c[0], m.c[0]), xdot3(m.c[1], m.c[1])), xdot3(m.c[2], m.c[2]));
+		xvec r = xmul(xsqrt(axes), xsplat(sm->boneRadius[j]));
+		xvec c = xformPoint(m, xload3(sm->boneCentre[j]));
+		lo = xmin(lo, xsub(c, r));
+		hi = xmax(hi, xadd(c, r));
+	}
+	float l[4], h[4];
+	xstore(l, lo);
+	xstore(h, hi);
+	if (l[0] > h[0]) return false;      //No weighted vertex
+	if (l[0] >= sm->quantMin.x && l[1] >= sm->quantMin.y && l[2] >= sm->quantMin.z
+		&& h[0] <= sm->quantMax.x && h[1] <= sm->quantMax.y && h[2] <= sm->quantMax.z) return false;
+
+	for (int i = 0; i < 3; i++)
+	{
+		float margin = SKIN_QUANT_MARGIN * (h[i] - l[i]);
+		float newMin = aisgl_min((&sm->quantMin.x)[i], l[i] - margin);
+		float newMax = aisgl_max((&sm->quantMax.x)[i], h[i] + margin);
+		(&sm->quantMin.x)[i] = newMin;
+		(&sm->quantMax.x)[i] = newMax;
+		(&sm->quantScale.x)[i] = (newMax > newMin) ? 65535.0f / (newMax - newMin) : 0;
+		(&sm->quantStep.x)[i] = (newMax - newMin) / 65535.0f;
+	}
+	sm->nRequantized++;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// Selects the format of the skinned vertices. The quantized stream and the
+// bones' spheres are allocated on first use; the box is kept across switches.
+// Every vertex is re-skinned at the next update.
+void setSkinOutput(skinnedMesh* sm, assetArena* arena, skeleton* skel, int output)
+{
+	int nverts = sm->mesh->mNumVertices;
+	if (output != SKIN_OUTPUT_FLOAT && sm->quantPositions == NULL)
+	{
+		sm->quantPositions = arenaAlloc<unsigned short>(arena, ARENA_SKINNING, 3 * nverts);
+		sm->quantMin = aiVector3D(FLT_MAX, FLT_MAX, FLT_MAX);
+		sm->quantMax = aiVector3D(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		sm->quantScale = sm->quantStep = aiVector3D(0, 0, 0);
+		sm->nRequantized = 0;
+
+		//Sphere of each bone: centre of the box of its weighted vertices, radius to the farthest
+		sm->boneCentre = arenaAlloc<aiVector3D>(arena, ARENA_SKINNING, sm->nBones);
+		sm->boneRadius = arenaAlloc<float>(arena, ARENA_SKINNING, sm->nBones);
+		std::vector<aiVector3D> lo(sm->nBones, aiVector3D(FLT_MAX, FLT_MAX, FLT_MAX)), hi(sm->nBones, aiVector3D(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+		for (int v = 0; v < nverts; v++)
+			for (int k = sm->infStart[v]; k < sm->infStart[v + 1]; k++)
+			{
+				int j = sm->infBone[k];
+				const aiVector3D& p = sm->bindVertices[v];
+				lo[j] = aiVector3D(aisgl_min(lo[j].x, p.x), aisgl_min(lo[j].y, p.y), aisgl_min(lo[j].z, p.z));
+				hi[j] = aiVector3D(aisgl_max(hi[j].x, p.x), aisgl_max(hi[j].y, p.y), aisgl_max(hi[j].z, p.z));
+			}
+		for (int j = 0; j < sm->nBones; j++)
+		{
+			sm->boneCentre[j] = (lo[j] + hi[j]) * 0.5f;
+			sm->boneRadius[j] = (lo[j].x > hi[j].x) ? -1 : 0;
+		}
+		for (int v = 0; v < nverts; v++)
+			for (int k = sm->infStart[v]; k < sm->infStart[v + 1]; k++)
+			{
+				int j = sm->infBone[k];
+				sm->boneRadius[j] = aisgl_max(sm->boneRadius[j], (sm->bindVertices[v] - sm->boneCentre[j]).Length());
+			}
+	}
+	if (output == SKIN_OUTPUT_OCT16 && sm->normals && sm->quantNormals16 == NULL)
+		sm->quantNormals16 = arenaAlloc<short>(arena, ARENA_SKINNING, 2 * nverts);
+	if (output == SKIN_OUTPUT_OCT8 && sm->normals && sm->quantNormals8 == NULL)
+		sm->quantNormals8 = arenaAlloc<signed char>(arena, ARENA_SKINNING, 2 * nverts);
+	sm->output = output;
+	chooseSkinKernels(sm);
+	markSkeletonDirty(skel);
+}
+
+// ----------------------------------------------------------------------------
+// Bytes per vertex of the skinned output
+int skinOutputBytes(const skinnedMesh* sm)
+{
+	if (sm->output == SKIN_OUTPUT_FLOAT) return sm->normals ? 24 : 12;
+	return 6 + (sm->normals ? (sm->output == SKIN_OUTPUT_OCT16 ? 4 : 2) : 0);
+}
+
+// ----------------------------------------------------------------------------
+// Positions and normals of the first nActive vertices decoded from the quantized stream
+void decodeSkinnedMesh(const skinnedMesh* sm, aiVector3D* posn, aiVector3D* norm)
+{
+	for (int v = 0; v < sm->nActive; v++)
+	{
+		const unsigned short* q = sm->quantPositions + 3 * v;
+		posn[v] = sm->quantMin + aiVector3D(q[0] * sm->quantStep.x, q[1] * sm->quantStep.y, q[2] * sm->quantStep.z);
+		if (!sm->normals) continue;
+		if (sm->output == SKIN_OUTPUT_OCT16)
+			norm[v] = octDecode(sm->quantNormals16[2 * v] / 32767.0f, sm->quantNormals16[2 * v + 1] / 32767.0f);
+		else
+			norm[v] = octDecode(sm->quantNormals8[2 * v] / 127.0f, sm->quantNormals8[2 * v + 1] / 127.0f);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Rebuilds the palette entries of the bones whose global matrix changed in the
+// last updateSkeleton() (flagged in boneChanged). Returns their number.
+int updatePalette(skinnedMesh* sm, const skeleton* skel)
+{
+	aiMesh* mesh = sm->mesh;
+	int nChanged = 0;
+	for (int j = 0; j < sm->nBones; j++)
+	{
+		int node = sm->boneNode[j];
+		sm->boneChanged[j] = false;
+		if (node < 0) continue;
+		int proxy = skel->proxy[node];     //The node itself unless dropped by the skeleton level of detail
+		if (!skel->changed[proxy]) continue;
+
+		xaffine global = xaffineLoad(skel->global[proxy]);
+		if (proxy != node) global = xaffineMul(global, xaffineLoad(skel->proxyOffset[node]));
+		sm->palette[j] = xaffineColumns(xaffineMul(global, xaffineLoad(mesh->mBones[j]->mOffsetMatrix)));
+		if (sm->normals) xformNormalColumns(sm->palette[j], sm->normalPalette[j]);
+		sm->boneChanged[j] = true;
+		nChanged++;
+	}
+	return nChanged;
+}
+
+// ----------------------------------------------------------------------------
+// Re-skins the vertices influenced by bones whose global matrix changed in the
+// last updateSkeleton(). Returns the number of vertices re-skinned.
+int skinMesh(skinnedMesh* sm, const skeleton* skel)
+{
+	int nRigid = 0, nDirty = 0;
+	sm->pass++;
+	updatePalette(sm, skel);
+
+	//A quantized pose outside the box: the box grows and every vertex is re-encoded
+	bool all = (sm->output != SKIN_OUTPUT_FLOAT) && growQuantBox(sm);
+
+	for (int j = 0; j < sm->nBones; j++)
+	{
+		if (!sm->boneChanged[j] && !(all && sm->boneNode[j] >= 0)) continue;
+		sm->skinRigid(sm, j);
+		nRigid += sm->rigidEnd[j] - sm->rigidStart[j];
+
+		for (int b = sm->blendStart[j]; b < sm->blendEnd[j]; b++)
+		{
+			int v = sm->blendVerts[b];
+			if (sm->stamp[v] == sm->pass) continue;
+			sm->stamp[v] = sm->pass;
+			sm->dirtyList[nDirty++] = v;
+		}
+	}
+
+	//Blended vertices: weighted sum over all of their bones
+	sm->skinBlended(sm, nDirty);
+	return nRigid + nDirty;
+}
+
+// ----------------------------------------------------------------------------
+// Limits skinning to the first nActive vertices. Vertices that become active
+// again are stale, so the whole skeleton is marked dirty for the next update.
+void setActiveVertices(skinnedMesh* sm, skeleton* skel, int nActive)
+{
+	if (nActive == sm->nActive) return;
+	if (nActive > sm->nActive) markSkeletonDirty(skel);
+	sm->nActive = nActive;
+	updateActiveEnds(sm);
+}
+
+// ----------------------------------------------------------------------------
+// Reports how many vertices of the mesh were moved off the blended path, and
+// the kernels chosen for it
+void printSkinInfo(const skinnedMesh* sm, int meshIndex)
+{
+	int nverts = sm->mesh->mNumVertices;
+	int nRigid = sm->rigidStart[sm->nBones], nSegments = 0, nBlended = 0;
+	for (int j = 0; j < sm->nBones; j++)
+		if (sm->rigidStart[j + 1] > sm->rigidStart[j]) nSegments++;
+	for (int v = 0; v < nverts; v++)
+		if (sm->infStart[v + 1] > sm->infStart[v]) nBlended++;
+	nBlended -= nRigid;
+	cout << "Skinning mesh " << meshIndex << ": " << nverts << " vertices, " << nRigid << " rigid ("
+		<< (nverts > 0 ? 100.0f * nRigid / nverts : 0) << "%) in " << nSegments << " segments, "
+		<< nBlended << " blended" << (sm->accumulate ? "" : " (last bone wins: all weighted vertices are rigid)") << endl;
+	cout << "  Kernels: " << (sm->normals ? "positions and normals" : "positions only");
+	if (sm->maxInfluences > 0)
+		cout << ", blended influences " << (sm->width > 0 ? "fixed x" : "") << sm->kernelName
+			<< " (at most " << sm->maxInfluences << " non-zero weights per vertex)";
+	cout << endl;
+}
@@ -0,0 +1,354 @@
+// ----------------------------------------------------------------------------
+// Verification helper functions
+//
+// A candidate animation engine is run against the reference one over every
+// tick of a clip. The reference is kept plain: the programs sample every bound
+// channel by the original key search, and referenceSkin() walks each node up
+// to the root and skins each vertex weight by weight, with none of the dirty
+// tracking, palettes or kernels of the optimised paths. Both engines pose the
+// same skeleton and skin the same meshes; after
+// each tick the global matrices of the active nodes and the skinned positions
+// and normals of the active vertices are compared within tolerances. Per-tick
+// checksums of the reference poses can be written to a golden file, and later
+// runs compared against it. Each engine is also timed over the clip, in passes
+// separate from the comparison, so that the speedup is reported on the same run.
+//
+// A checksum holds a hash of the values rounded to the tolerances and their
+// sums. Rounding may flip a value that lies on a boundary, so a tick whose hash
+// differs still passes if its sums agree within the tolerances.
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+
+#define VERIFY_MATRIX_TOLERANCE 1e-4f      //Matrix elements, relative to max(1, |element|)
+#define VERIFY_POSN_TOLERANCE 1e-5f        //Positions, relative to the model's extent
+#define VERIFY_NORMAL_TOLERANCE 1e-4f      //Normals (as skinned, not normalised)
+#define VERIFY_REPEATS 5                   //Timed passes over the clip per engine
+
+struct poseEngine
+{
+	const char* name;
+	void (*pose)(int tick);       //Poses the skeleton at a tick of the selected clip and skins the meshes
+	bool matrices;                //Leaves the nodes' global matrices in the skeleton (else only vertices are compared)
+};
+
+struct verifyTarget
+{
+	skeleton* skel;
+	skinnedMesh* skinData;
+	int nMeshes;
+	float extent;                 //Size of the model (scales the position tolerance)
+	void (*reset)();              //Forgets the last pose, so that the next one is evaluated in full
+};
+
+struct poseChecksum
+{
+	unsigned long long hash;
+	double posnSum[3], normalSum[3], matrixSum;
+};
+
+struct verifyReport
+{
+	int nTicks, nFailed;          //Ticks with a value out of tolerance
+	int worstTick;
+	double matrixError, posnError, normalError;   //Largest errors (relative as the tolerances)
+	double referenceTime, candidateTime;          //Seconds per tick
+	int goldenExact, goldenClose, goldenFailed;   //Reference ticks against the golden file (-1: none read)
+};
+
+// ----------------------------------------------------------------------------
+// Reference skeleton and skinning, from the nodes' local transformations: the
+// global matrix of each node by the product along its parent chain, and each
+// vertex as the sum over the mesh's bones of its weights (or, where the mesh
+// does not accumulate, the last bone's transformation with full weight).
+// Bones are followed at full detail; the optimised paths are compared at level 0.
+void referenceSkin(skeleton* skel, skinnedMesh* skinData, int nMeshes)
+{
+	for (int i = 0; i < skel->nNodes; i++)
+	{
+		aiMatrix4x4 global;
+		for (int n = i; n >= 0; n = skel->parent[n])
+			if (!skel->ignored[n]) global = skel->nodes[n]->mTransformation * global;
+		skel->global[i] = global;
+	}
+	for (int m = 0; m < nMeshes; m++)
+	{
+		skinnedMesh* sm = &skinData[m];
+		aiMesh* mesh = sm->mesh;
+		for (int j = 0; j < mesh->mNumBones; j++)     //Weighted vertices start from zero
+		{
+			const aiBone* bone = mesh->mBones[j];
+			for (int k = 0; k < bone->mNumWeights; k++)
+			{
+				int v = bone->mWeights[k].mVertexId;
+				if (v >= sm->nActive || !sm->accumulate) continue;
+				mesh->mVertices[v] = aiVector3D(0, 0, 0);
+				if (sm->normals) mesh->mNormals[v] = aiVector3D(0, 0, 0);
+			}
+		}
+		for (int j = 0; j < mesh->mNumBones; j++)
+		{
+			if (sm->boneNode[j] < 0) continue;
+			const aiBone* bone = mesh->mBones[j];
+			aiMatrix4x4 matrix = skel->global[sm->boneNode[j]] * bone->mOffsetMatrix;
+			aiMatrix4x4 normalMatrix = matrix;
+			normalMatrix.Inverse().Transpose();
+			for (int k = 0; k < bone->mNumWeights; k++)
+			{
+				int v = bone->mWeights[k].mVertexId;
+				if (v >= sm->nActive) continue;
+				float w = sm->accumulate ? bone->mWeights[k].mWeight : 1.0f;
+				aiVector3D posn = w * (matrix * sm->bindVertices[v]);
+				aiVector3D norm = sm->normals ? w * (aiMatrix3x3(normalMatrix) * sm->bindNormals[v]) : aiVector3D(0, 0, 0);
+				if (sm->accumulate)
+				{
+					mesh->mVertices[v] += posn;
+					if (sm->normals) mesh->mNormals[v] += norm;
+				}
+				else
+				{
+					mesh->mVertices[v] = posn;
+					if (sm->normals) mesh->mNormals[v] = norm;
+				}
+			}
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Number of values in one pose: 16 per active node, 3 + 3 per active vertex
+int poseSize(const verifyTarget* vt)
+{
+	int n = 16 * vt->skel->nActive;
+	for (int m = 0; m < vt->nMeshes; m++) n += 6 * vt->skinData[m].nActive;
+	return n;
+}
+
+// ----------------------------------------------------------------------------
+// Copies the current pose: matrices (row-major) first, then per mesh the positions and normals
+void snapshotPose(const verifyTarget* vt, float* out)
+{
+	const skeleton* skel = vt->skel;
+	for (int i = 0; i < skel->nActive; i++, out += 16)
+		memcpy(out, &skel->global[i].a1, 16 * sizeof(float));
+	for (int m = 0; m < vt->nMeshes; m++)
+	{
+		const skinnedMesh* sm = &vt->skinData[m];
+		memcpy(out, sm->mesh->mVertices, 3 * sm->nActive * sizeof(float));
+		out += 3 * sm->nActive;
+		if (sm->normals) memcpy(out, sm->mesh->mNormals, 3 * sm->nActive * sizeof(float));
+		else memset(out, 0, 3 * sm->nActive * sizeof(float));
+		out += 3 * sm->nActive;
+	}
+}
+
+// ----------------------------------------------------------------------------
+void checksumPose(const verifyTarget* vt, const float* pose, poseChecksum* ck)
+{
+	unsigned long long h = 14695981039346656037ULL;   //FNV-1a
+	ck->matrixSum = 0;
+	for (int k = 0; k < 3; k++) ck->posnSum[k] = ck->normalSum[k] = 0;
+	int nMatrix = 16 * vt->skel->nActive;
+	for (int i = 0; i < nMatrix; i++)
+	{
+		long long q = llround(pose[i] / VERIFY_MATRIX_TOLERANCE);
+		h = (h ^ (unsigned long long)q) * 1099511628211ULL;
+		ck->matrixSum += pose[i];
+	}
+	const float* p = pose + nMatrix;
+	float posnStep = VERIFY_POSN_TOLERANCE * vt->extent;
+	for (int m = 0; m < vt->nMeshes; m++)
+	{
+		int n = vt->skinData[m].nActive;
+		for (int i = 0; i < 3 * n; i++)
+		{
+			long long q = llround(p[i] / posnStep);
+			h = (h ^ (unsigned long long)q) * 1099511628211ULL;
+			ck->posnSum[i % 3] += p[i];
+		}
+		p += 3 * n;
+		for (int i = 0; i < 3 * n; i++)
+		{
+			long long q = llround(p[i] / VERIFY_NORMAL_TOLERANCE);
+			h = (h ^ (unsigned long long)q) * 1099511628211ULL;
+			ck->normalSum[i % 3] += p[i];
+		}
+		p += 3 * n;
+	}
+	ck->hash = h;
+}
+
+// ----------------------------------------------------------------------------
+// Compares a pose with the reference one; updates the largest errors and
+// returns false if any value is out of tolerance
+bool comparePose(const verifyTarget* vt, const float* pose, const float* ref, bool matrices, verifyReport* vr)
+{
+	bool ok = true;
+	int nMatrix = 16 * vt->skel->nActive;
+	if (matrices)
+		for (int i = 0; i < nMatrix; i++)
+		{
+			double e = fabs(pose[i] - ref[i]) / aisgl_max(1.0f, fabs(ref[i]));
+			vr->matrixError = aisgl_max(vr->matrixError, e);
+			if (e > VERIFY_MATRIX_TOLERANCE) ok = false;
+		}
+	pose += nMatrix;
+	ref += nMatrix;
+	for (int m = 0; m < vt->nMeshes; m++)
+	{
+		int n = vt->skinData[m].nActive;
+		for (int v = 0; v < n; v++, pose += 3, ref += 3)
+		{
+			double e = aiVector3D(pose[0] - ref[0], pose[1] - ref[1], pose[2] - ref[2]).Length() / vt->extent;
+			vr->posnError = aisgl_max(vr->posnError, e);
+			if (e > VERIFY_POSN_TOLERANCE) ok = false;
+		}
+		for (int v = 0; v < n; v++, pose += 3, ref += 3)
+		{
+			double e = aiVector3D(pose[0] - ref[0], pose[1] - ref[1], pose[2] - ref[2]).Length();
+			vr->normalError = aisgl_max(vr->normalError, e);
+			if (e > VERIFY_NORMAL_TOLERANCE) ok = false;
+		}
+	}
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+// Seconds per tick of an engine, over VERIFY_REPEATS passes through the clip
+double timeEngine(const verifyTarget* vt, const poseEngine* engine, int nTicks)
+{
+	vt->reset();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int r = 0; r < VERIFY_REPEATS; r++)
+		for (int t = 0; t < nTicks; t++) engine->pose(t);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / (VERIFY_REPEATS * nTicks);
+}
+
+// ----------------------------------------------------------------------------
+// Golden file: a "clip <name> <ticks> <values per pose>" line, then one line per tick
+void writeGoldenFile(const char* fileName, const char* clipName, int nTicks, int size, const poseChecksum* ck)
+{
+	FILE* fp = fopen(fileName, "w");
+	if (fp == NULL)
+	{
+		cout << "Verify: could not open " << fileName << endl;
+		return;
+	}
+	fprintf(fp, "clip %s %d %d\n", clipName, nTicks, size);
+	for (int t = 0; t < nTicks; t++)
+		fprintf(fp, "%d %016llx %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", t, ck[t].hash, ck[t].posnSum[0], ck[t].posnSum[1],
+			ck[t].posnSum[2], ck[t].normalSum[0], ck[t].normalSum[1], ck[t].normalSum[2], ck[t].matrixSum);
+	fclose(fp);
+	cout << "Verify: " << nTicks << " checksums written to " << fileName << endl;
+}
+
+// ----------------------------------------------------------------------------
+// Compares the reference checksums with a golden file. Sums are compared with
+// the tolerances scaled by the number of values summed.
+void compareGoldenFile(const char* fileName, const verifyTarget* vt, int nTicks, int size, const poseChecksum* ck, verifyReport* vr)
+{
+	FILE* fp = fopen(fileName, "r");
+	char name[256];
+	int nGolden, goldenSize;
+	if (fp == NULL || fscanf(fp, "clip %255s %d %d", name, &nGolden, &goldenSize) != 3 || nGolden != nTicks || goldenSize != size)
+	{
+		cout << "Verify: " << fileName << " is not a golden file of this clip and model" << endl;
+		if (fp != NULL) fclose(fp);
+		vr->goldenFailed = nTicks;
+		return;
+	}
+	int nMatrix = 16 * vt->skel->nActive, nVertices = (size - nMatrix) / 6;
+	double posnTolerance = VERIFY_POSN_TOLERANCE * vt->extent * nVertices;
+	double normalTolerance = VERIFY_NORMAL_TOLERANCE * nVertices;
+	double matrixTolerance = VERIFY_MATRIX_TOLERANCE * nMatrix;
+	for (int t = 0; t < nTicks; t++)
+	{
+		int tick;
+		poseChecksum g;
+		if (fscanf(fp, "%d %llx %lf %lf %lf %lf %lf %lf %lf", &tick, &g.hash, &g.posnSum[0], &g.posnSum[1], &g.posnSum[2],
+			&g.normalSum[0], &g.normalSum[1], &g.normalSum[2], &g.matrixSum) != 9 || tick != t)
+		{
+			vr->goldenFailed += nTicks - t;
+			break;
+		}
+		if (g.hash == ck[t].hash)
+		{
+			vr->goldenExact++;
+			continue;
+		}
+		bool close = fabs(g.matrixSum - ck[t].matrixSum) <= matrixTolerance;
+		for (int k = 0; k < 3; k++)
+			close = close && fabs(g.posnSum[k] - ck[t].posnSum[k]) <= posnTolerance
+				&& fabs(g.normalSum[k] - ck[t].normalSum[k]) <= normalTolerance;
+		if (close) vr->goldenClose++;
+		else vr->goldenFailed++;
+	}
+	fclose(fp);
+}
+
+// ----------------------------------------------------------------------------
+// Runs the reference and the candidate over ticks 0 .. nTicks-1 of the clip the
+// program has selected. "goldenFile" (may be NULL) is written if "writeGolden"
+// is set, otherwise compared with the reference poses. Returns true if the
+// candidate stayed within the tolerances (and the golden file matched).
+bool verifyClip(verifyReport* vr, const verifyTarget* vt, const char* clipName, int nTicks,
+	const poseEngine* reference, const poseEngine* candidate, const char* goldenFile, bool writeGolden)
+{
+	vr->nTicks = nTicks;
+	vr->nFailed = 0;
+	vr->worstTick = -1;
+	vr->matrixError = vr->posnError = vr->normalError = 0;
+	vr->goldenExact = vr->goldenClose = vr->goldenFailed = 0;
+
+	vr->referenceTime = timeEngine(vt, reference, nTicks);
+	vr->candidateTime = timeEngine(vt, candidate, nTicks);
+
+	int size = poseSize(vt);
+	float* refPoses = new float[(long)nTicks * size];
+	float* pose = new float[size];
+	poseChecksum* ck = new poseChecksum[nTicks];
+	vt->reset();
+	for (int t = 0; t < nTicks; t++)
+	{
+		reference->pose(t);
+		snapshotPose(vt, refPoses + (long)t * size);
+		checksumPose(vt, refPoses + (long)t * size, &ck[t]);
+	}
+	vt->reset();
+	bool matrices = reference->matrices && candidate->matrices;
+	for (int t = 0; t < nTicks; t++)
+	{
+		candidate->pose(t);
+		snapshotPose(vt, pose);
+		double worst = vr->posnError;
+		if (!comparePose(vt, pose, refPoses + (long)t * size, matrices, vr)) vr->nFailed++;
+		if (vr->posnError > worst) vr->worstTick = t;
+	}
+	vt->reset();
+
+	if (goldenFile != NULL && !writeGolden) compareGoldenFile(goldenFile, vt, nTicks, size, ck, vr);
+	else vr->goldenExact = vr->goldenClose = vr->goldenFailed = -1;
+	if (goldenFile != NULL && writeGolden) writeGoldenFile(goldenFile, clipName, nTicks, size, ck);
+	delete[] refPoses;
+	delete[] pose;
+	delete[] ck;
+	return vr->nFailed == 0 && vr->goldenFailed <= 0;
+}
+
+// ----------------------------------------------------------------------------
+void printVerifyReport(const verifyReport* vr, const char* clipName, const poseEngine* reference, const poseEngine* candidate)
+{
+	cout << "Verify " << clipName << ": " << candidate->name << " against " << reference->name << ", " << vr->nTicks << " ticks: "
+		<< (vr->nFailed == 0 ? "PASS" : "FAIL") << " (" << vr->nFailed << " ticks out of tolerance)" << endl;
+	cout << "    largest errors: matrix " << vr->matrixError << " (" << VERIFY_MATRIX_TOLERANCE << "), position "
+		<< vr->posnError << " x extent (" << VERIFY_POSN_TOLERANCE << ", tick " << vr->worstTick << "), normal "
+		<< vr->normalError << " (" << VERIFY_NORMAL_TOLERANCE << ")" << endl;
+	cout << "    " << reference->name << " " << 1000 * vr->referenceTime << " ms/tick, " << candidate->name << " "
+		<< 1000 * vr->candidateTime << " ms/tick (speedup " << (vr->candidateTime > 0 ? vr->referenceTime / vr->candidateTime : 0) << "x)" << endl;
+	if (vr->goldenExact >= 0)
+		cout << "    golden: " << vr->goldenExact << " ticks exact, " << vr->goldenClose << " within tolerance, "
+			<< vr->goldenFailed << " failed" << endl;
+}
@@ -0,0 +1,480 @@
+// ----------------------------------------------------------------------------
+// SIMD transform helper functions
+//
+// Four-lane vector versions of the assimp matrix operations used by the
+// animation loop. An xmat4 holds the four rows of an aiMatrix4x4 (same memory
+// layout, so arrays of aiMatrix4x4 are loaded and stored directly), an xaffine
+// the top three rows of an affine one (last row 0 0 0 1). Vertices are
+// transformed by columns: an xcolumns holds the three axes and the origin of
+// an affine matrix, so that p' = x * c[0] + y * c[1] + z * c[2] + c[3], with
+// the coordinates broadcast once per vertex. Normal matrices (the inverse
+// transpose of the upper 3x3) come from cross products of the columns.
+//
+// The batch versions convert quaternions four at a time (structure of arrays
+// after a 4x4 transpose). SSE is used where available, plain floats otherwise;
+// the results agree with assimp's to rounding (see benchmarkTransforms()).
+// ai_real must be float.
+//-----------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstdlib>
+#include <chrono>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define XFORM_SSE
+#endif
+
+// ----------------------------------------------------------------------------
+// Four-lane vector
+#ifdef XFORM_SSE
+typedef __m128 xvec;
+
+inline xvec xload(const float* p) { return _mm_loadu_ps(p); }
+inline void xstore(float* p, xvec v) { _mm_storeu_ps(p, v); }
+inline xvec xset(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+inline xvec xsplat(float f) { return _mm_set1_ps(f); }
+inline xvec xzero() { return _mm_setzero_ps(); }
+inline xvec xadd(xvec a, xvec b) { return _mm_add_ps(a, b); }
+inline xvec xsub(xvec a, xvec b) { return _mm_sub_ps(a, b); }
+inline xvec xmul(xvec a, xvec b) { return _mm_mul_ps(a, b); }
+inline xvec xdiv(xvec a, xvec b) { return _mm_div_ps(a, b); }
+inline xvec xmin(xvec a, xvec b) { return _mm_min_ps(a, b); }
+inline xvec xmax(xvec a, xvec b) { return _mm_max_ps(a, b); }
+inline float xget0(xvec v) { return _mm_cvtss_f32(v); }
+template <int i0, int i1, int i2, int i3> inline xvec xswizzle(xvec v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(i3, i2, i1, i0)); }
+inline void xtranspose(xvec& a, xvec& b, xvec& c, xvec& d) { _MM_TRANSPOSE4_PS(a, b, c, d); }
+inline xvec xsqrt(xvec v) { return _mm_sqrt_ps(v); }
+inline xvec xabs(xvec v) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), v); }
+inline xvec xflipsign(xvec v, xvec s) { return _mm_xor_ps(v, _mm_and_ps(s, _mm_set1_ps(-0.0f))); }   //-v where s is negative
+
+//x, y, z of a vector (the fourth lane is not written)
+inline void xstore3(float* p, xvec v)
+{
+	_mm_storel_pi((__m64*)p, v);
+	_mm_store_ss(p + 2, _mm_movehl_ps(v, v));
+}
+#else
+struct xvec { float f[4]; };
+
+inline xvec xset(float x, float y, float z, float w) { xvec r = { { x, y, z, w } }; return r; }
+inline xvec xload(const float* p) { return xset(p[0], p[1], p[2], p[3]); }
+inline void xstore(float* p, xvec v) { for (int i = 0; i < 4; i++) p[i] = v.f[i]; }
+inline void xstore3(float* p, xvec v) { for (int i = 0; i < 3; i++) p[i] = v.f[i]; }
+inline xvec xsplat(float f) { return xset(f, f, f, f); }
+inline xvec xzero() { return xsplat(0); }
+inline xvec xadd(xvec a, xvec b) { return xset(a.f[0] + b.f[0], a.f[1] + b.f[1], a.f[2] + b.f[2], a.f[3] + b.f[3]); }
+inline xvec xsub(xvec a, xvec b) { return xset(a.f[0] - b.f[0], a.f[1] - b.f[1], a.f[2] - b.f[2], a.f[3] - b.f[3]); }
+inline xvec xmul(xvec a, xvec b) { return xset(a.f[0] * b.f[0], a.f[1] * b.f[1], a.f[2] * b.f[2], a.f[3] * b.f[3]); }
+inline xvec xdiv(xvec a, xvec b) { return xset(a.f[0] / b.f[0], a.f[1] / b.f[1], a.f[2] / b.f[2], a.f[3] / b.f[3]); }
+inline xvec xmin(xvec a, xvec b) { return xset(fminf(a.f[0], b.f[0]), fminf(a.f[1], b.f[1]), fminf(a.f[2], b.f[2]), fminf(a.f[3], b.f[3])); }
+inline xvec xmax(xvec a, xvec b) { return xset(fmaxf(a.f[0], b.f[0]), fmaxf(a.f[1], b.f[1]), fmaxf(a.f[2], b.f[2]), fmaxf(a.f[3], b.f[3])); }
+inline float xget0(xvec v) { return v.f[0]; }
+inline xvec xsqrt(xvec v) { return xset(sqrtf(v.f[0]), sqrtf(v.f[1]), sqrtf(v.f[2]), sqrtf(v.f[3])); }
+inline xvec xabs(xvec v) { return xset(fabsf(v.f[0]), fabsf(v.f[1]), fabsf(v.f[2]), fabsf(v.f[3])); }
+inline xvec xflipsign(xvec v, xvec s)
+{
+	xvec r = v;
+	for (int i = 0; i < 4; i++) if (std::signbit(s.f[i])) r.f[i] = -r.f[i];
+	return r;
+}
+template <int i0, int i1, int i2, int i3> inline xvec xswizzle(xvec v) { return xset(v.f[i0], v.f[i1], v.f[i2], v.f[i3]); }
+inline void xtranspose(xvec& a, xvec& b, xvec& c, xvec& d)
+{
+	xvec r[4] = { a, b, c, d };
+	a = xset(r[0].f[0], r[1].f[0], r[2].f[0], r[3].f[0]);
+	b = xset(r[0].f[1], r[1].f[1], r[2].f[1], r[3].f[1]);
+	c = xset(r[0].f[2], r[1].f[2], r[2].f[2], r[3].f[2]);
+	d = xset(r[0].f[3], r[1].f[3], r[2].f[3], r[3].f[3]);
+}
+#endif
+
+inline xvec xmadd(xvec a, xvec b, xvec c) { return xadd(xmul(a, b), c); }     //a * b + c
+template <int i> inline xvec xlane(xvec v) { return xswizzle<i, i, i, i>(v); }
+
+inline xvec xload3(const aiVector3D& v) { return xset(v.x, v.y, v.z, 0); }
+
+//Cross product of the x, y, z lanes (fourth lane 0)
+inline xvec xcross(xvec a, xvec b)
+{
+	xvec c = xsub(xmul(a, xswizzle<1, 2, 0, 3>(b)), xmul(xswizzle<1, 2, 0, 3>(a), b));
+	return xswizzle<1, 2, 0, 3>(c);
+}
+
+//Dot product of the x, y, z lanes, in every lane
+inline xvec xdot3(xvec a, xvec b)
+{
+	xvec p = xmul(a, b);
+	return xadd(xadd(xlane<0>(p), xlane<1>(p)), xlane<2>(p));
+}
+
+// ----------------------------------------------------------------------------
+// Transformation types
+struct xmat4                  //Rows of an aiMatrix4x4
+{
+	xvec r[4];
+};
+
+struct xaffine                //Top three rows of an affine aiMatrix4x4
+{
+	xvec r[3];
+};
+
+struct xcolumns               //Columns of an affine matrix: three axes and the origin (fourth lanes 0)
+{
+	xvec c[4];
+};
+
+inline xmat4 xformLoad(const aiMatrix4x4& m)
+{
+	const float* p = &m.a1;
+	xmat4 x = { { xload(p), xload(p + 4), xload(p + 8), xload(p + 12) } };
+	return x;
+}
+
+inline void xformStore(const xmat4& x, aiMatrix4x4& m)
+{
+	float* p = &m.a1;
+	for (int i = 0; i < 4; i++) xstore(p + 4 * i, x.r[i]);
+}
+
+inline xaffine xaffineLoad(const aiMatrix4x4& m)
+{
+	const float* p = &m.a1;
+	xaffine x = { { xload(p), xload(p + 4), xload(p + 8) } };
+	return x;
+}
+
+inline void xaffineStore(const xaffine& x, aiMatrix4x4& m)
+{
+	float* p = &m.a1;
+	for (int i = 0; i < 3; i++) xstore(p + 4 * i, x.r[i]);
+	xstore(p + 12, xset(0, 0, 0, 1));
+}
+
+// ----------------------------------------------------------------------------
+// a * b (as aiMatrix4x4::operator*)
+inline xmat4 xformMul(const xmat4& a, const xmat4& b)
+{
+	xmat4 m;
+	for (int i = 0; i < 4; i++)
+	{
+		xvec r = xmul(xlane<0>(a.r[i]), b.r[0]);
+		r = xmadd(xlane<1>(a.r[i]), b.r[1], r);
+		r = xmadd(xlane<2>(a.r[i]), b.r[2], r);
+		m.r[i] = xmadd(xlane<3>(a.r[i]), b.r[3], r);
+	}
+	return m;
+}
+
+// ----------------------------------------------------------------------------
+// a * b for affine matrices: three rows, and b's implicit last row only adds a's translation
+inline xaffine xaffineMul(const xaffine& a, const xaffine& b)
+{
+	const xvec unitW = xset(0, 0, 0, 1);
+	xaffine m;
+	for (int i = 0; i < 3; i++)
+	{
+		xvec r = xmul(xlane<0>(a.r[i]), b.r[0]);
+		r = xmadd(xlane<1>(a.r[i]), b.r[1], r);
+		r = xmadd(xlane<2>(a.r[i]), b.r[2], r);
+		m.r[i] = xmadd(xlane<3>(a.r[i]), unitW, r);
+	}
+	return m;
+}
+
+// ----------------------------------------------------------------------------
+inline xcolumns xaffineColumns(const xaffine& a)
+{
+	xcolumns c = { { a.r[0], a.r[1], a.r[2], xzero() } };
+	xtranspose(c.c[0], c.c[1], c.c[2], c.c[3]);
+	return c;
+}
+
+// ----------------------------------------------------------------------------
+// Inverse of an affine matrix: the rows of the 3x3 inverse are cross products
+// of its columns (divided by the determinant), the translation is -inverse * t
+inline xaffine xaffineInverse(const xaffine& a)
+{
+	xcolumns c = xaffineColumns(a);
+	xvec i0 = xcross(c.c[1], c.c[2]);
+	xvec det = xdot3(c.c[0], i0);
+	i0 = xdiv(i0, det);
+	xvec i1 = xdiv(xcross(c.c[2], c.c[0]), det);
+	xvec i2 = xdiv(xcross(c.c[0], c.c[1]), det);
+	xvec unused = xzero();
+	xtranspose(i0, i1, i2, unused);            //Now the columns of the inverse
+	xvec t = xmul(i0, xlane<0>(c.c[3]));
+	t = xmadd(i1, xlane<1>(c.c[3]), t);
+	t = xsub(xzero(), xmadd(i2, xlane<2>(c.c[3]), t));
+	xtranspose(i0, i1, i2, t);
+	xaffine m = { { i0, i1, i2 } };
+	return m;
+}
+
+// ----------------------------------------------------------------------------
+// Normal matrix (inverse transpose of the 3x3 part) by columns: the columns of
+// the inverse transpose are the rows of the inverse
+inline void xformNormalColumns(const xcolumns& m, xcolumns& n)
+{
+	n.c[0] = xcross(m.c[1], m.c[2]);
+	xvec det = xdot3(m.c[0], n.c[0]);
+	n.c[0] = xdiv(n.c[0], det);
+	n.c[1] = xdiv(xcross(m.c[2], m.c[0]), det);
+	n.c[2] = xdiv(xcross(m.c[0], m.c[1]), det);
+	n.c[3] = xzero();
+}
+
+// ----------------------------------------------------------------------------
+// m * p for a point (origin included) and for a direction
+inline xvec xformPoint(const xcolumns& m, xvec p)
+{
+	xvec r = xmadd(xlane<0>(p), m.c[0], m.c[3]);
+	r = xmadd(xlane<1>(p), m.c[1], r);
+	return xmadd(xlane<2>(p), m.c[2], r);
+}
+
+inline xvec xformDirection(const xcolumns& m, xvec d)
+{
+	xvec r = xmul(xlane<0>(d), m.c[0]);
+	r = xmadd(xlane<1>(d), m.c[1], r);
+	return xmadd(xlane<2>(d), m.c[2], r);
+}
+
+// ----------------------------------------------------------------------------
+// Batch versions
+void xformMulBatch(const aiMatrix4x4* a, const aiMatrix4x4* b, aiMatrix4x4* out, int n)
+{
+	for (int i = 0; i < n; i++) xformStore(xformMul(xformLoad(a[i]), xformLoad(b[i])), out[i]);
+}
+
+void xaffineMulBatch(const aiMatrix4x4* a, const aiMatrix4x4* b, aiMatrix4x4* out, int n)
+{
+	for (int i = 0; i < n; i++) xaffineStore(xaffineMul(xaffineLoad(a[i]), xaffineLoad(b[i])), out[i]);
+}
+
+void xaffineInverseBatch(const aiMatrix4x4* a, aiMatrix4x4* out, int n)
+{
+	for (int i = 0; i < n; i++) xaffineStore(xaffineInverse(xaffineLoad(a[i])), out[i]);
+}
+
+//Normal matrices of affine matrices, as aiMatrix3x3 (rows)
+void xformNormalBatch(const aiMatrix4x4* a, aiMatrix3x3* out, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		xcolumns nm;
+		xformNormalColumns(xaffineColumns(xaffineLoad(a[i])), nm);
+		xtranspose(nm.c[0], nm.c[1], nm.c[2], nm.c[3]);
+		for (int r = 0; r < 3; r++) xstore3(&out[i].a1 + 3 * r, nm.c[r]);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Translation(t) * rotation(q) of four channels, with the unit quaternions and the
+// translations held by component (lane j: channel j). The first k are stored.
+inline void xformStoreFromQuat4(aiMatrix4x4* out, int k, xvec w, xvec x, xvec y, xvec z, xvec tx, xvec ty, xvec tz)
+{
+	const xvec one = xsplat(1), two = xsplat(2);
+	const xvec unitW = xset(0, 0, 0, 1);
+	xvec x2 = xmul(two, x), y2 = xmul(two, y), z2 = xmul(two, z);
+	xvec xx = xmul(x, x2), yy = xmul(y, y2), zz = xmul(z, z2);
+	xvec xy = xmul(x, y2), xz = xmul(x, z2), yz = xmul(y, z2);
+	xvec wx = xmul(w, x2), wy = xmul(w, y2), wz = xmul(w, z2);
+
+	xvec r0[4] = { xsub(one, xadd(yy, zz)), xsub(xy, wz), xadd(xz, wy), tx };
+	xvec r1[4] = { xadd(xy, wz), xsub(one, xadd(xx, zz)), xsub(yz, wx), ty };
+	xvec r2[4] = { xsub(xz, wy), xadd(yz, wx), xsub(one, xadd(xx, yy)), tz };
+	xtranspose(r0[0], r0[1], r0[2], r0[3]);   //Row 0 of each of the four matrices
+	xtranspose(r1[0], r1[1], r1[2], r1[3]);
+	xtranspose(r2[0], r2[1], r2[2], r2[3]);
+	for (int j = 0; j < k; j++)
+	{
+		float* p = &out[j].a1;
+		xstore(p, r0[j]);
+		xstore(p + 4, r1[j]);
+		xstore(p + 8, r2[j]);
+		xstore(p + 12, unitW);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Translation(t) * rotation(q) of n channels, as aiMatrix4x4::Translation() times
+// aiQuaternion::GetMatrix(). Four quaternions at a time: w, x, y, z transposed
+// into lanes, the nine rotation terms computed for all four, and transposed back
+// into rows with the translations.
+void xformFromQuatBatch(const aiQuaternion* q, const aiVector3D* t, aiMatrix4x4* out, int n)
+{
+	for (int i = 0; i < n; i += 4)
+	{
+		int k = aisgl_min(4, n - i);
+		aiQuaternion qs[4];
+		aiVector3D ts[4];
+		for (int j = 0; j < k; j++)
+		{
+			qs[j] = q[i + j];
+			ts[j] = t[i + j];
+		}
+		xvec w = xload(&qs[0].w), x = xload(&qs[1].w), y = xload(&qs[2].w), z = xload(&qs[3].w);
+		xtranspose(w, x, y, z);                  //Rows were quaternions (w, x, y, z); now each holds one component of all four
+		xformStoreFromQuat4(out + i, k, w, x, y, z, xset(ts[0].x, ts[1].x, ts[2].x, ts[3].x),
+			xset(ts[0].y, ts[1].y, ts[2].y, ts[3].y), xset(ts[0].z, ts[1].z, ts[2].z, ts[3].z));
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Microbenchmarks: each primitive against its assimp version, over random
+// affine matrices (rotation, scale from 1 to 2, translation up to 100). Reports the
+// time per operation and the largest difference of an element.
+float xformRandom(float range)
+{
+	return range * (2.0f * rand() / RAND_MAX - 1.0f);
+}
+
+aiQuaternion xformRandomRotation()
+{
+	aiQuaternion q(xformRandom(1), xformRandom(1), xformRandom(1), xformRandom(1));
+	q.Normalize();
+	return q;
+}
+
+float xformMaxError(const float* a, const float* b, int n)
+{
+	float e = 0;
+	for (int i = 0; i < n; i++) e = aisgl_max(e, (float)fabs(a[i] - b[i]));
+	return e;
+}
+
+void printTransformBench(const char* name, double assimpNs, double simdNs, float error)
+{
+	printf("    %-22s %10.2f %10.2f %8.2fx %12.2e\n", name, assimpNs, simdNs, assimpNs / simdNs, error);
+}
+
+int benchmarkTransforms(int n = 1024, int nRepeats = 2000)
+{
+	typedef std::chrono::steady_clock clock;
+	srand(1);
+	aiMatrix4x4* a = new aiMatrix4x4[n];
+	aiMatrix4x4* b = new aiMatrix4x4[n];
+	aiMatrix4x4* ref = new aiMatrix4x4[n];
+	aiMatrix4x4* out = new aiMatrix4x4[n];
+	aiMatrix3x3* ref3 = new aiMatrix3x3[n];
+	aiMatrix3x3* out3 = new aiMatrix3x3[n];
+	aiQuaternion* q = new aiQuaternion[n];
+	aiVector3D* t = new aiVector3D[n];
+	aiVector3D* v = new aiVector3D[n];
+	aiVector3D* refV = new aiVector3D[n];
+	aiVector3D* outV = new aiVector3D[n];
+	for (int i = 0; i < n; i++)
+	{
+		q[i] = xformRandomRotation();
+		t[i] = aiVector3D(xformRandom(100), xformRandom(100), xformRandom(100));
+		v[i] = aiVector3D(xformRandom(10), xformRandom(10), xformRandom(10));
+		aiMatrix4x4 scale;
+		aiMatrix4x4::Scaling(aiVector3D(1.5f + xformRandom(0.5f), 1.5f + xformRandom(0.5f), 1.5f + xformRandom(0.5f)), scale);
+		aiMatrix4x4::Translation(t[i], a[i]);
+		a[i] = a[i] * aiMatrix4x4(q[i].GetMatrix()) * scale;
+		aiMatrix4x4::Translation(-t[i], b[i]);
+		b[i] = b[i] * aiMatrix4x4(xformRandomRotation().GetMatrix());
+	}
+	double ops = (double)n * nRepeats;
+	double assimpNs, simdNs;
+	clock::time_point start;
+
+	cout << "Transform microbenchmarks (" << n << " matrices, " << nRepeats << " passes"
+#ifdef XFORM_SSE
+		<< ", SSE):" << endl;
+#else
+		<< ", scalar fallback):" << endl;
+#endif
+	printf("    %-22s %10s %10s %9s %12s\n", "primitive", "assimp ns", "simd ns", "speedup", "max error");
+
+	start = clock::now();
+	for (int r = 0; r < nRepeats; r++)
+		for (int i = 0; i < n; i++) ref[i] = a[i] * b[(i + r) % n];
+	assimpNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ops;
+	start = clock::now();
+	for (int r = 0; r < nRepeats; r++)
+		for (int i = 0; i < n; i++) xformStore(xformMul(xformLoad(a[i]), xformLoad(b[(i + r) % n])), out[i]);
+	simdNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ops;
+	printTransformBench("4x4 multiply", assimpNs, simdNs, xformMaxError(&ref[0].a1, &out[0].a1, 16 * n));
+
+	start = clock::now();
+	for (int r = 0; r < nRepeats; r++)
+		for (int i = 0; i < n; i++) ref[i] = a[i] * b[(i + r) % n];
+	assimpNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ops;
+	start = clock::now();
+	for (int r = 0; r < nRepeats; r++)
+		for (int i = 0; i < n; i++) xaffineStore(xaffineMul(xaffineLoad(a[i]), xaffineLoad(b[(i + r) % n])), out[i]);
+	simdNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ops;
+	printTransformBench("affine multiply", assimpNs, simdNs, xformMaxError(&ref[0].a1, &out[0].a1, 16 * n));
+
+	start = clock::now();
+	for (int r = 0; r < nRepeats; r++)
+		for (int i = 0; i < n; i++)
+		{
+			aiMatrix4x4 m;
+			aiMatrix4x4::Translation(t[i], m);
+			ref[i] = m * aiMatrix4x4(q[i].GetMatrix());
+		}
+	assimpNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ops;
+	start = clock::now();
+	for (int r = 0; r < nRepeats; r++) xformFromQuatBatch(q, t, out, n);
+	simdNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ops;
+	printTransformBench("quaternion to matrix", assimpNs, simdNs, xformMaxError(&ref[0].a1, &out[0].a1, 16 * n));
+
+	start = clock::now();
+	for (int r = 0; r < nRepeats; r++)
+		for (int i = 0; i < n; i++)
+		{
+			ref[i] = a[i];
+			ref[i].Inverse();
+		}
+	assimpNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ops;
+	start = clock::now();
+	for (int r = 0; r < nRepeats; r++) xaffineInverseBatch(a, out, n);
+	simdNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ops;
+	printTransformBench("affine inverse", assimpNs, simdNs, xformMaxError(&ref[0].a1, &out[0].a1, 16 * n));
+
+	start = clock::now();
+	for (int r = 0; r < nRepeats; r++)
+		for (int i = 0; i < n; i++)
+		{
+			aiMatrix4x4 m = a[i];
+			ref3[i] = aiMatrix3x3(m.Inverse().Transpose());
+		}
+	assimpNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ops;
+	start = clock::now();
+	for (int r = 0; r < nRepeats; r++) xformNormalBatch(a, out3, n);
+	simdNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ops;
+	printTransformBench("inverse transpose", assimpNs, simdNs, xformMaxError(&ref3[0].a1, &out3[0].a1, 9 * n));
+
+	start = clock::now();
+	for (int r = 0; r < nRepeats; r++)
+	{
+		const aiMatrix4x4& m = a[r % n];
+		for (int i = 0; i < n; i++) refV[i] = m * v[i];
+	}
+	assimpNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ops;
+	start = clock::now();
+	for (int r = 0; r < nRepeats; r++)
+	{
+		xcolumns m = xaffineColumns(xaffineLoad(a[r % n]));
+		for (int i = 0; i < n; i++) xstore3(&outV[i].x, xformPoint(m, xload3(v[i])));
+	}
+	simdNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / ops;
+	printTransformBench("point transform", assimpNs, simdNs, xformMaxError(&refV[0].x, &outV[0].x, 3 * n));
+
+	delete[] a;
+	delete[] b;
+	delete[] ref;
+	delete[] out;
+	delete[] ref3;
+	delete[] out3;
+	delete[] q;
+	delete[] t;
+	delete[] v;
+	delete[] refV;
+	delete[] outV;
+	fflush(stdout);
+	return 0;
+}
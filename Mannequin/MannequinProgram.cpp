@@ -4,10 +4,20 @@
 //  FILE NAME: MannequinProgram.cpp
 //  
 //  Press key '1' to toggle 90 degs model rotation about x-axis on/off.
+//  Press key 'c' to start/stop capturing the window to capture_0000.ppm...
+//  (asynchronous readback; link with -pthread).
+//  Press key 'h' to show/hide the frame stage timings (CPU and GPU, rolling percentiles).
+//  Set TRACE_FILE=<file> (or pass --trace <file>) to write a timeline of the load and of every
+//  frame, per thread, for chrome://tracing or Perfetto.
+//
+//  Headless mode (no window or GPU needed, link with -lEGL):
+//      MannequinProgram --headless out/mannequin --frames 100 --size 640 480 [--raw]
 //  ========================================================================
 
+#define GL_GLEXT_PROTOTYPES
 #include <iostream>
 #include <map>
+#include <cstring>
 #include <GL/freeglut.h>
 #include <IL/il.h>
 using namespace std;
@@ -17,6 +27,27 @@ using namespace std;
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "assimp_extras.h"
+#include "arena_extras.h"
+#include "alloc_extras.h"
+#include "xform_extras.h"
+#include "mesh_extras.h"
+#include "lod_extras.h"
+#include "anim_extras.h"
+#include "sampler_extras.h"
+#include "skin_extras.h"
+#include "offscreen_extras.h"
+#include "capture_extras.h"
+#include "crowd_extras.h"
+#include "vat_extras.h"
+#include "impostor_extras.h"
+#include "trace_extras.h"
+#include "pipeline_extras.h"
+#include "perf_extras.h"
+#include "profile_extras.h"
+#include "verify_extras.h"
+#include "quant_extras.h"
+#include "gpuskin_extras.h"
+#include "synth_extras.h"
 
 //----------Globals----------------------------
 const aiScene* modelScene = NULL;
@@ -31,6 +62,9 @@ int currTick = 0; //current tick
 float timeStep = 50; //Animation time step = 50 m.sec
 
 
+//---------Frame Capture-----------------------
+frameCapture capture;
+
 //---------Camera Variables--------------------
 float radius = 3, angle=0, look_x, look_y = 0, look_z=0, eye_x = 0, eye_y = 0, eye_z = radius, prev_eye_x = eye_x, prev_eye_z=eye_z;  //Camera parameters
 
@@ -39,7 +73,10 @@ int z_floor_close = -5000, z_floor_far = 5000;
 int floor_shift = 1;
 
 //---------Model Position Variables---------------------
-int z_model = 0;
+rootMotion runMotion;           //Root motion of the run clip (in-place: moves 50 units per tick)
+aiMatrix3x3 modelOrientation;   //Model -> world rotation, same as the glRotatef() in display()
+aiVector3D cycleStart;          //World position of the model at the start of the current cycle
+aiVector3D modelPosn;           //Current world position, driven by the root motion track
 
 //------------Modify the following as needed----------------------
 float materialCol[4] = { 0.5, 0.4, 0.3, 1 };   //Default material colour (not used if model's colour is available)
@@ -56,32 +93,104 @@ struct meshInit
 
 meshInit* initData;
 
+//---------Asset Arenas------------------------
+assetArena modelArena;          //Runtime data built from the model (bind pose, weights, skinning, lods)
+assetArena animationArena;      //... and from the animation file (skeleton, clip)
+size_t releasedWeights = 0;     //Bytes of bone weights freed from the scene once copied into the influence tables
+
+//---------Level of Detail---------------------
+meshLod* lodData;               //Level of detail chain of each mesh
+int currentLod = 0;             //Level used for skinning and drawing
+int forcedLod = -1;             //Level chosen with the 'l' key or --lod (-1: from the projected size)
+
+//---------Crowd-------------------------------
+crowd crowdData;                //Instances drawn around the lead character (none unless --crowd n)
+poseCache poses;                //Poses shared by instances with the same clip, tick and level of detail
+int crowdSize = 0;              //--crowd n
+int crowdPhases = 1;            //--phases k: number of distinct tick offsets (1: lockstep)
+int crowdQuantum = 1;           //--quantize q: instance ticks are rounded down to a multiple of q
+int crowdTick = 0;              //Tick and clip of the lead character, from which the instances are offset
+const aiAnimation* crowdClip = NULL;
+
+//---------Vertex Animation--------------------
+vertexAnimation vat;            //Baked clip, played back by crowd instances at VAT_MIN_LOD and beyond
+bool vatReady = false;
+bool vatInMesh = false;         //The mesh arrays hold played-back vertices instead of the skinned pose
+const char* vatBakeFile = NULL; //--bake-vat <file>: bake the run and save it
+const char* vatLoadFile = NULL; //--vat <file>: load a baked run
+
+//---------Impostors---------------------------
+impostorAtlas impostors;        //Sprites of the crowd clip, drawn for the most distant instances
+bool useImpostors = false;      //--impostors
+bool impostorsReady = false;
+
+//---------Frame Pipeline----------------------
+framePipeline pipeline;         //Animation thread and triple-buffered skinned frames (--pipeline)
+bool usePipeline = false;
+const frameSlot* drawnFrame = NULL;   //Frame being drawn (NULL: the meshes' own vertices)
+aiVector3D viewPosn;            //Model position followed by the camera (that of the drawn frame)
+
+//---------Profiling---------------------------
+frameProfiler profiler;         //Stage timers: overlay with the 'h' key, CSV log with --profile <file>
+const char* profileFile = NULL;
+bool useCounters = false;       //Hardware counters per stage, reported on exit (--counters)
+
+//---------Synthetic Model---------------------
+syntheticSpec synthetic;        //Generated rig, mesh and clip, loaded instead of the model file (--synthetic <spec>)
+bool useSynthetic = false;
+
+//---------Skinning Data-----------------------
+skeleton skel;                  //Flattened node tree with dirty flags
+skinnedMesh* skinData;          //Bone palette and vertex influences of each mesh
+clipInfo runInfo;               //Channel bindings and constant tracks of the clip
+channelSampler runSampler;      //Key cursors and batched evaluation of the clip
+bool scalarSampling = false;    //Original per-channel sampling instead (the scalar-sampler engine of --verify)
+int poseTick = -1;              //Tick and clip of the current pose
+const aiAnimation* poseClip = NULL;
+
+//---------GPU Skinning------------------------
+bool useGpuSkinning = false;    //--gpu-skinning: meshes skinned in the vertex shader, from a palette uploaded per draw
+gpuSkinner gpuSkin;             //Shader programs (one per influence count)
+gpuSkinnedMesh* gpuMeshes = NULL;   //Static buffers of each mesh (not ready: skinned on the CPU)
+
 //-------Loads model data from file and creates a scene object----------
 bool loadModel(const char* fileName)
 {
-    modelScene = aiImportFile(fileName, aiProcessPreset_TargetRealtime_MaxQuality);
+    traceMark t = beginTrace("import model");
+    if(useSynthetic) {
+        modelScene = buildSyntheticScene(&synthetic, aiVector3D(0, 0, 1));
+        fileName = "synthetic";
+    }
+    else modelScene = aiImportFile(fileName, aiProcessPreset_TargetRealtime_MaxQuality);
+    endTrace(t);
     if(modelScene == NULL) exit(1);
+    createArena(&modelArena, fileName);
     //printSceneInfo(modelScene);
     //printMeshInfo(modelScene);
     //printTreeInfo(modelScene->mRootNode);
     //printBoneInfo(modelScene);
     //printAnimInfo(modelScene);  //WARNING:  This may generate a lengthy output if the model has animation data
     
-    initData = new meshInit[modelScene->mNumMeshes];
+    t = beginTrace("optimise meshes");
+    optimizeMeshes(modelScene, fileName);     //Reorders faces and vertices: must precede initData
+    endTrace(t);
+    t = beginTrace("build mesh lods");
+    lodData = arenaAlloc<meshLod>(&modelArena, ARENA_LODS, modelScene->mNumMeshes);
+    for (int i = 0; i < modelScene->mNumMeshes; i++)
+    {
+        buildMeshLods(&lodData[i], &modelArena, modelScene->mMeshes[i]);   //Also reorders vertices
+        printMeshLods(&lodData[i], i);
+    }
+    endTrace(t);
+    
+    initData = arenaAlloc<meshInit>(&modelArena, ARENA_BIND_POSE, modelScene->mNumMeshes);
     
     for (int i = 0; i < modelScene->mNumMeshes; i++)
     {
         aiMesh* mesh = modelScene->mMeshes[i];
         (initData + i)->mNumVertices = mesh->mNumVertices;
-        (initData + i)->mVertices = new aiVector3D[mesh->mNumVertices];
-        (initData + i)->mNormals = new aiVector3D[mesh->mNumVertices];
-        
-        for (int j = 0; j < mesh->mNumVertices; j++)
-        {
-            (initData + i)->mVertices[j] = mesh->mVertices[j];
-            (initData + i)->mNormals[j] = mesh->mNormals[j];
-        }
-        
+        (initData + i)->mVertices = arenaCopy(&modelArena, ARENA_BIND_POSE, mesh->mVertices, mesh->mNumVertices);
+        (initData + i)->mNormals = mesh->HasNormals() ? arenaCopy(&modelArena, ARENA_BIND_POSE, mesh->mNormals, mesh->mNumVertices) : NULL;
     }
     
     get_bounding_box(modelScene, &scene_min, &scene_max);
@@ -91,9 +200,45 @@ bool loadModel(const char* fileName)
 //-------Loads model data from file and creates a scene object----------
 bool loadAnimation(const char* fileName)
 {
-    animationScene = aiImportFile(fileName, aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_Debone);
-    tDuration = animationScene->mAnimations[0]->mDuration;
+    traceMark t = beginTrace("import animation");
+    if(useSynthetic) {   //The generated scene holds its own clip and skeleton
+        animationScene = modelScene;
+        fileName = "synthetic";
+    }
+    else animationScene = aiImportFile(fileName, aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_Debone);
+    endTrace(t);
     if(animationScene == NULL) exit(1);
+    createArena(&animationArena, fileName);
+    tDuration = animationScene->mAnimations[0]->mDuration;
+    
+    aiMatrix4x4 rotn;
+    modelOrientation = aiMatrix3x3(aiMatrix4x4::RotationX(-AI_MATH_HALF_PI_F, rotn));
+    //The model is z-up: world +z (the running direction) is model -y
+    extractRootMotion(&runMotion, &animationArena, animationScene->mAnimations[0], animationScene->mRootNode,
+        aiVector3D(0, 0, 1), aiVector3D(0, -50, 0), "free3dmodel_skeleton");
+    
+    //The model's bones are animated through the hierarchy of the animation scene
+    t = beginTrace("build skinning");
+    buildSkeleton(&skel, &animationArena, animationScene->mRootNode, "free3dmodel_skeleton");
+    sortSkeletonByImportance(&skel, modelScene);   //Before any skeleton index is stored
+    printSkeletonLods(&skel);
+    skinData = arenaAlloc<skinnedMesh>(&modelArena, ARENA_SKINNING, modelScene->mNumMeshes);
+    for (int i = 0; i < modelScene->mNumMeshes; i++)
+    {
+        buildSkinnedMesh(&skinData[i], &modelArena, modelScene->mMeshes[i], &skel, initData[i].mVertices, initData[i].mNormals, useSynthetic);   //Generated weights are blended
+        printSkinInfo(&skinData[i], i);
+    }
+    releasedWeights = releaseBoneWeights(modelScene);   //Held by the influence tables from now on
+    endTrace(t);
+    
+    aiAnimation* anim = animationScene->mAnimations[0];
+    int* channelNode = new int[anim->mNumChannels];
+    for (int i = 0; i < anim->mNumChannels; i++)
+        channelNode[i] = findSkeletonNode(&skel, anim->mChannels[i]->mNodeName);
+    analyseClip(&runInfo, &animationArena, anim, channelNode);
+    printClipAnalysis(&runInfo, fileName);
+    buildChannelSampler(&runSampler, &animationArena, &runInfo);
+    delete[] channelNode;
     //printSceneInfo(animationScene);
     //printMeshInfo(animationScene);
     //printTreeInfo(animationScene->mRootNode);
@@ -103,11 +248,35 @@ bool loadAnimation(const char* fileName)
     return true;
 }
 
+//----Memory held by the loaded assets----
+void printAssetMemory()
+{
+    printArenaUsage(&modelArena);
+    printArenaUsage(&animationArena);
+    cout << "Scene: " << releasedWeights << " bytes of bone weights released after load" << endl;
+}
+
+//----Releases the assets and all the runtime data built from them (the arenas), ready for the next load----
+void unloadModel()
+{
+    releaseArena(&modelArena);
+    releaseArena(&animationArena);
+    if(animationScene != NULL && animationScene != modelScene) aiReleaseImport(animationScene);   //The same scene with --synthetic
+    aiReleaseImport(modelScene);
+    modelScene = animationScene = NULL;
+    currentLod = 0;
+    poseTick = -1;
+    poseClip = NULL;
+    gpuMeshes = NULL;   //In the model arena; the buffers go with the GL context
+}
 
 // ------A recursive function to traverse scene graph and render each mesh----------
 void render (const aiScene* sc, const aiNode* nd)
 {
-    aiMatrix4x4 m = nd->mTransformation;
+    //A pipelined frame has its own copy of the mesh nodes' global transformations: the animation thread may be writing the nodes
+    aiMatrix4x4 m;
+    if(drawnFrame == NULL) m = nd->mTransformation;
+    else if(nd->mNumMeshes > 0) m = frameNodeTransform(&pipeline, drawnFrame, nd);
     aiMesh* mesh;
     aiFace* face;
     aiMaterial* mtl;
@@ -135,10 +304,23 @@ void render (const aiScene* sc, const aiNode* nd)
             glColor4fv(materialCol);   //Default material colour
 
 
-        //Get the polygons from each mesh and draw them
-        for (int k = 0; k < mesh->mNumFaces; k++)
+        //Vertices: the meshes' own, or those of the frame published by the animation thread
+        const aiVector3D* vertices = (drawnFrame != NULL) ? drawnFrame->vertices[meshIndex] : mesh->mVertices;
+        const aiVector3D* normals = (drawnFrame != NULL) ? drawnFrame->normals[meshIndex] : mesh->mNormals;
+        int drawLod = (drawnFrame != NULL) ? drawnFrame->lod : currentLod;
+
+        //Get the polygons of the current level of detail and draw them
+        const meshLod* lod = &lodData[meshIndex];
+        int level = aisgl_min(drawLod, lod->nLods - 1);
+
+        //Skinned by the vertex shader, unless the vertices are those of a pipelined frame or of the vertex animation
+        if(useGpuSkinning && gpuMeshes[meshIndex].ready && drawnFrame == NULL && !vatInMesh) {
+            drawGpuSkinnedMesh(&gpuSkin, &gpuMeshes[meshIndex], &skinData[meshIndex], level, twoSidedLight);
+            continue;
+        }
+        for (int k = 0; k < lod->nFaces[level]; k++)
         {
-            face = &mesh->mFaces[k];
+            face = &lod->faces[level][k];
             GLenum face_mode;
 
             switch(face->mNumIndices)
@@ -166,15 +348,20 @@ void render (const aiScene* sc, const aiNode* nd)
                 }
 
                 if (mesh->HasNormals())
-                    glNormal3fv(&mesh->mNormals[vertexIndex].x);
+                    glNormal3fv(&normals[vertexIndex].x);
 
-                glVertex3fv(&mesh->mVertices[vertexIndex].x);
+                glVertex3fv(&vertices[vertexIndex].x);
             }
 
             glEnd();
         }
     }
 
+    if(drawnFrame != NULL) {   //Global transformations: the children start again from the parent's matrix
+        glPopMatrix();
+        glPushMatrix();
+    }
+
     // Draw all children
     for (int i = 0; i < nd->mNumChildren; i++)
         render(sc, nd->mChildren[i]);
@@ -182,6 +369,27 @@ void render (const aiScene* sc, const aiNode* nd)
     glPopMatrix();
 }
 
+//----Skinned vertices and evaluated bones per frame, for the per-vertex and per-bone counter figures----
+void setProfileScale()
+{
+    profiler.nVertices = 0;
+    for (int i = 0; i < modelScene->mNumMeshes; i++)
+        profiler.nVertices += skinData[i].nActive;
+    profiler.nBones = skel.nActive;
+}
+
+//----Uploads the static mesh data for skinning in the vertex shader; false if no mesh can be drawn that way----
+bool setupGpuSkinning()
+{
+    if(!createGpuSkinner(&gpuSkin)) return false;
+    gpuMeshes = arenaAlloc<gpuSkinnedMesh>(&modelArena, ARENA_SKINNING, modelScene->mNumMeshes);
+    int nReady = 0;
+    for (int i = 0; i < modelScene->mNumMeshes; i++)
+        if(buildGpuSkinnedMesh(&gpuSkin, &gpuMeshes[i], &skinData[i], &lodData[i])) nReady++;
+    cout << "GPU skinning: " << nReady << " of " << modelScene->mNumMeshes << " meshes skinned in the vertex shader" << endl;
+    return nReady > 0;
+}
+
 //--------------------OpenGL initialization------------------------
 void initialise()
 {
@@ -202,154 +410,124 @@ void initialise()
     glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, white);
     glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 50);
     glColor4fv(materialCol);
+    traceMark t = beginTrace("load assets");
     loadModel("mannequin.fbx"); 
     loadAnimation("run.fbx");
            //<<<-------------Specify input file name here
+    printAssetMemory();
     //loadGLTextures(scene);
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
     gluPerspective(35, 1, 1.0, 1000.0);
+    if(useGpuSkinning && !setupGpuSkinning()) useGpuSkinning = false;
+    createProfiler(&profiler, profileFile, useCounters);
+    setProfileScale();
+    endTrace(t);
+}
+
+void skinModel()
+{
+    profileMark m = beginProfile(&profiler, PROFILE_SKIN);
+    for (int i = 0; i < modelScene->mNumMeshes; i++)
+        if(useGpuSkinning && gpuMeshes[i].ready) updatePalette(&skinData[i], &skel);   //The shader skins the vertices
+        else skinMesh(&skinData[i], &skel);
+    endProfile(&profiler, m);
 }
 
 void transformVertices()
 {
-    
+    profileMark m = beginProfile(&profiler, PROFILE_HIERARCHY);
+    int nChanged = updateSkeleton(&skel);
+    endProfile(&profiler, m);
+    if (nChanged == 0) return;   //No bone moved: keep the skinned vertices
+    skinModel();
+}
+
+//----Selects the mesh and skeleton levels of detail; vertices and nodes beyond the level's prefix are not updated (without "reskin", the stale nodes are left dirty for the caller's pose)----
+void setModelLod(int level, bool reskin = true)
+{
+    if(level == currentLod) return;
+    currentLod = level;
     for (int i = 0; i < modelScene->mNumMeshes; i++)
     {
-        aiMesh* mesh = modelScene->mMeshes[i];
-        for (int j = 0; j < mesh->mNumBones; j++)
-        {
-            aiBone* bone = mesh->mBones[j];
-            aiMatrix4x4 limatrix = bone->mOffsetMatrix;
-            aiNode* node = animationScene->mRootNode->FindNode(bone->mName);
-            aiMatrix4x4 mimatrix = limatrix;
-            
-            while(node->mParent != NULL) {
-                if(node->mName != aiString("free3dmodel_skeleton")) {
-                    aiMatrix4x4 qamatrix = node->mTransformation;
-                    mimatrix = qamatrix * mimatrix;
-                    node = node->mParent;
-                } else {
-                    node = node->mParent;
-                }
-            }
-            //Form the normal matrix.
-            aiMatrix4x4 normalMatrix = mimatrix;
-            normalMatrix.Inverse().Transpose();
-            
-            for(int k = 0; k < bone->mNumWeights; k++)
-            {
-                aiVertexWeight weight = bone->mWeights[k];
-                int vid = weight.mVertexId;
-                
-                aiVector3D vert = (initData + i)->mVertices[vid];
-                aiVector3D norm = (initData + i)->mNormals[vid];
-                
-                //Make a 3x3 of the matrix and multiply it by the 3d vector
-                mesh->mVertices[vid] = aiMatrix3x3(mimatrix) * vert + aiVector3D(mimatrix.a4, mimatrix.b4, mimatrix.c4);
-                mesh->mNormals[vid] = aiMatrix3x3(normalMatrix) * norm + aiVector3D(normalMatrix.a4, normalMatrix.b4, normalMatrix.c4);
-            }
-        }
+        int meshLevel = aisgl_min(level, lodData[i].nLods - 1);
+        setActiveVertices(&skinData[i], &skel, lodData[i].nVertices[meshLevel]);
     }
+    setSkeletonLod(&skel, level);
+    setProfileScale();
+    if(reskin) transformVertices();
 }
 
 void updateNodeMatrices(int tick)
 {
     aiAnimation* anim = animationScene->mAnimations[0];
-    aiMatrix4x4 matPos, matRot, matProd;
-    aiMatrix3x3 matRot3;
-    aiNode* nd;
+    clipInfo* ci = &runInfo;
+    channelSampler* sampler = &runSampler;
     
-    for (int i = 0; i < anim->mNumChannels; i++)
-    {
-        matPos = aiMatrix4x4(); //Identity
-        matRot = aiMatrix4x4();
-        aiNodeAnim* channel = anim->mChannels[i]; //Channel
-        aiVector3D posn;
-        
-        // Position Keys
-        if (channel->mNumPositionKeys > 1) {
-            for (int positionIndex = 0; positionIndex < channel->mNumPositionKeys; positionIndex++)
-            {
-                if(tick < channel->mPositionKeys[positionIndex].mTime) {
-                    aiVector3D   pos1 = (channel->mPositionKeys[positionIndex-1]).mValue;
-                    aiVector3D   pos2 = (channel->mPositionKeys[positionIndex]).mValue;
-                    double time1 = (channel->mPositionKeys[positionIndex-1]).mTime;
-                    double time2 = (channel->mPositionKeys[positionIndex]).mTime;
-                    float factor = (tick-time1)/(time2-time1);
-                    posn = pos2 - pos1;
-                    posn = pos1 + (factor * posn);
-                    break;
-                } else if(tick == channel->mPositionKeys[positionIndex].mTime) {
-                    posn = (channel->mPositionKeys[positionIndex]).mValue;
-                    break;
-                }
-            }
-            matPos.Translation(posn, matPos);
-        } else {
-            posn = (channel->mPositionKeys[0]).mValue;
-            matPos.Translation(posn, matPos);
-        }
-        
-        aiQuaternion rotn;
-        
-        // Rotation Keys
-        if (channel->mNumRotationKeys > 1) {
-        
-            for (int rotationIndex = 0; rotationIndex < channel->mNumRotationKeys; rotationIndex++)
-            {
-                if(tick < channel->mRotationKeys[rotationIndex].mTime) {
-                    aiQuaternion rotn1 = (channel->mRotationKeys[rotationIndex-1]).mValue;
-                    aiQuaternion rotn2 = (channel->mRotationKeys[rotationIndex]).mValue;
-                    double time1 = (channel->mRotationKeys[rotationIndex-1]).mTime;
-                    double time2 = (channel->mRotationKeys[rotationIndex]).mTime;
-                    float factor = (tick-time1)/(time2-time1);
-                    rotn.Interpolate(rotn, rotn1, rotn2, factor);
-                    break;
-                } else if(tick == channel->mRotationKeys[rotationIndex].mTime) {
-                    rotn = (channel->mRotationKeys[rotationIndex]).mValue; 
-                    break;
-                }
-            }
-            matRot3 = rotn.GetMatrix();
-            matRot = aiMatrix4x4(matRot3);
-        } else {
-            rotn = (channel->mRotationKeys[0]).mValue;
-            matRot3 = rotn.GetMatrix();
-            matRot = aiMatrix4x4(matRot3);
-        }
-        
-        matProd = matPos * matRot;
-        nd = animationScene->mRootNode->FindNode(channel->mNodeName);
-        nd->mTransformation = matProd;
-    }
+    if (tick == poseTick && anim == poseClip) return;   //Same pose as the last update
+    //Channels with a constant local transformation only need writing when the clip changes
+    bool newClip = (anim != poseClip);
+    int nChannels = newClip ? ci->nBound : ci->nAnimated;
+    int* channels = newClip ? ci->bound : ci->animated;
+    poseTick = tick;
+    poseClip = anim;
+    profileMark sampling = beginProfile(&profiler, PROFILE_SAMPLE);
+    
+    //Channels are in skeleton order: those dropped by the skeleton level of detail come last
+    int nSampled = 0;
+    while (nSampled < nChannels && (newClip || ci->node[channels[nSampled]] < skel.nActive)) nSampled++;
+    if(scalarSampling) sampleChannelsScalar(sampler, channels, nSampled, tick, &runMotion);
+    else sampleChannels(sampler, channels, nSampled, tick, &runMotion);
+    for (int c = 0; c < nSampled; c++) setNodeTransform(&skel, ci->node[channels[c]], sampler->local[c]);
+    endProfile(&profiler, sampling);
     transformVertices();
 }
 
-void update(int value)
+//----Advances the animation by one tick----
+//----Poses the lead character, or leaves the posing to drawCrowd() when a crowd is drawn----
+void poseModel(int tick)
+{
+    crowdTick = tick;
+    crowdClip = animationScene->mAnimations[0];
+    if(crowdData.nInstances == 0) updateNodeMatrices(tick);
+}
+
+//----Re-skins the whole model after vertex animation playback overwrote the mesh arrays----
+void restoreSkinnedVertices()
+{
+    if(!vatInMesh) return;
+    markSkeletonDirty(&skel);
+    transformVertices();
+    vatInMesh = false;
+}
+
+//----Full evaluation of one frame of the run, as skinned for the bake----
+void bakeFrame(int tick)
+{
+    poseTick = -1;
+    updateNodeMatrices(tick);
+    restoreSkinnedVertices();
+}
+
+
+void stepAnimation()
 {
     tDuration = animationScene->mAnimations[0]->mDuration;
-    if (currTick < tDuration)
+    if (currTick >= tDuration)
     {
-        updateNodeMatrices(currTick);
-        glutTimerFunc(timeStep, update, 0);
-        currTick++;
-    } 
-    else {
         currTick = 0;
-        updateNodeMatrices(currTick);
-        glutTimerFunc(timeStep, update, 0);
-        currTick++;
-    }
-    
-    z_model += 50;
-  
-    if(z_model > (2500 * floor_shift)) {
-        floor_shift++;
-        z_floor_far += 7500;
-        
+        cycleStart = cycleStart + modelOrientation * rootMotionCycle(&runMotion);
     }
+    poseModel(currTick);
+    modelPosn = cycleStart + modelOrientation * rootMotionOffset(&runMotion, currTick);
+    currTick++;
+}
 
+void update(int value)
+{
+    if(usePipeline) pipelineTick(&pipeline);   //The animation thread steps once per tick
+    else stepAnimation();
+    glutTimerFunc(timeStep, update, 0);
     glutPostRedisplay();
 }
 
@@ -367,6 +545,20 @@ void keyboard(unsigned char key, int x, int y)
 {
      //if(key == '1') embeddedAnimation = !embeddedAnimation; 
     //if(key == '2') modelRotn = !modelRotn;  //Enable/disable initial model rotation 
+    if(key == 'l') {
+        forcedLod = (forcedLod + 2) % (MAX_LODS + 1) - 1;   //auto, 0, 1, ..., MAX_LODS-1
+        if(forcedLod < 0) cout << "LOD: automatic" << endl;
+        else cout << "LOD: " << forcedLod << endl;
+    }
+    if(key == 'p' && crowdData.nInstances > 0) printPoseCacheStats(&poses, crowdData.nInstances);
+    if(key == 'h') {
+        profiler.hud = !profiler.hud;
+        profiler.enabled = profiler.hud || profiler.csv != NULL || profiler.counters;
+    }
+    if(key == 'c') {
+        if(capture.active) stopCapture(&capture);
+        else startCapture(&capture, "capture", false, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+    }
     glutPostRedisplay();
 }
 
@@ -393,16 +585,148 @@ void drawFloor()
     glEnd();
 }
 
-//------The main display function---------
-//----The model is first drawn using a display list so that all GL commands are
-//    stored for subsequent display updates.
-void display()
+//------Draws the model at the given position (model units)---------
+void drawCharacter(aiVector3D posn)
+{
+    glPushMatrix();
+    glTranslatef(posn.x, posn.y, posn.z);
+    glRotatef(-90, 1.0f, 0 ,0);  
+    profileMark m = beginProfile(&profiler, PROFILE_RENDER);
+    render(modelScene, modelScene->mRootNode);
+    endProfile(&profiler, m);
+    glPopMatrix();
+}
+
+//----Level of detail from the projected size of the model's bounding sphere at the given position (IMPOSTOR_LOD if allowed)----
+int lodAt(aiVector3D posn, float scale, bool impostor = false)
+{
+    if(forcedLod >= 0) return forcedLod;
+    aiVector3D follow = viewPosn * scale, centre = posn * scale;
+    aiVector3D eye(eye_x + follow.x, eye_y, eye_z + follow.z);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    float pixels = projectedSize(0.5f * (scene_max - scene_min).Length() * scale, (eye - centre).Length(), 35, viewport[3]);
+    if(impostor && pixels < IMPOSTOR_SCREEN_SIZE) return IMPOSTOR_LOD;
+    return selectLod(pixels);
+}
+
+//------Draws the crowd: instances with the same clip, tick and level of detail share one pose------
+void drawCrowd(float scale)
+{
+    int n = crowdData.nInstances;
+    int duration = (crowdClip != NULL) ? aisgl_max((int)crowdClip->mDuration, 1) : 1;
+    poses.frame++;
+    for (int i = 0; i < n; i++)
+    {
+        crowdInstance* inst = &crowdData.instances[i];
+        inst->tick = quantizeTick(&poses, (crowdTick + inst->phase) % duration);
+        inst->lod = lodAt(viewPosn + inst->offset, scale, impostorsReady && crowdClip == impostors.clip);
+    }
+    sortCrowd(&crowdData);
+    aiVector3D follow = viewPosn * scale;   //Camera position in the frame of drawCharacter()
+    aiVector3D eye = aiVector3D(eye_x + follow.x, eye_y, eye_z + follow.z) / scale + 0.5f * (scene_min + scene_max);
+
+    for (int first = 0, last; first < n; first = last)
+    {
+        const crowdInstance* inst = &crowdData.instances[crowdData.order[first]];
+        for (last = first + 1; last < n; last++)
+        {
+            const crowdInstance* other = &crowdData.instances[crowdData.order[last]];
+            if(other->tick != inst->tick || other->lod != inst->lod) break;
+        }
+
+        if(inst->lod == IMPOSTOR_LOD) {   //All remaining instances are impostors
+            beginImpostors(&impostors);
+            for (int k = first; k < n; k++) {
+                const crowdInstance* other = &crowdData.instances[crowdData.order[k]];
+                drawImpostor(&impostors, viewPosn + other->offset, other->tick, eye);
+            }
+            endImpostors();
+            break;
+        }
+        setModelLod(inst->lod, false);   //Skinned once below, with the group's pose
+        if(vatReady && crowdClip == vat.clip && inst->lod >= VAT_MIN_LOD) {   //Distant: no skeleton at all
+            playVertexAnimation(&vat, inst->tick, skinData);
+            vatInMesh = true;
+        }
+        else if(crowdClip != NULL) {
+            if(vatInMesh) {   //Every vertex is re-skinned below, with the group's pose
+                markSkeletonDirty(&skel);
+                vatInMesh = false;
+            }
+            poseKey key = { crowdClip, inst->tick, inst->lod };
+            int entry = findPose(&poses, key, last - first);
+            if(entry >= 0) {
+                if(restorePose(&poses, entry, &skel) > 0) skinModel();
+                poseTick = key.tick;
+                poseClip = key.clip;
+            } else {
+                poseTick = -1;     //Re-evaluate all channels: nodes enabled by a finer level may be stale
+                updateNodeMatrices(key.tick);
+                storePose(&poses, key, &skel);
+            }
+        }
+        for (int k = first; k < last; k++)
+            drawCharacter(viewPosn + crowdData.instances[crowdData.order[k]].offset);
+    }
+}
+
+//----Draws the model for the impostor atlas----
+void drawImpostorModel()
 {
+    drawCharacter(aiVector3D(0, 0, 0));
+}
+
+//----Creates the crowd and its pose cache, then bakes or loads the vertex animation and bakes the impostors----
+void setupCrowd()
+{
+    const aiAnimation* clip = animationScene->mAnimations[0];
+    if(crowdSize > 0) {
+        float extent = aisgl_max(aisgl_max(scene_max.x - scene_min.x, scene_max.y - scene_min.y), scene_max.z - scene_min.z);
+        createCrowd(&crowdData, crowdSize, 1.2f * extent, crowdPhases, clip->mDuration);
+        createPoseCache(&poses, skel.nNodes, crowdQuantum);
+    }
+
+    setModelLod(0);
+    bool gpuSkinning = useGpuSkinning;
+    useGpuSkinning = false;         //The vertex animation bake reads the skinned mesh arrays
+    traceMark t = beginTrace("bake crowd data");
+    if(vatBakeFile != NULL) {
+        bakeVertexAnimation(&vat, clip, clip->mDuration + 1, skinData, modelScene->mNumMeshes, bakeFrame);
+        saveVertexAnimation(&vat, vatBakeFile);
+        printVertexAnimationInfo(&vat, skinData, vat.bakeTime / vat.nFrames);
+        vatReady = vatInMesh = true;
+    }
+    else if(vatLoadFile != NULL) vatReady = loadVertexAnimation(&vat, vatLoadFile, clip, skinData, modelScene->mNumMeshes);
+    if(useImpostors)
+        impostorsReady = bakeImpostors(&impostors, clip, aiVector3D(0.5f * (scene_min.x + scene_max.x), 0.5f * (scene_min.z + scene_max.z), -0.5f * (scene_min.y + scene_max.y)), 0.5f * (scene_max - scene_min).Length(), bakeFrame, drawImpostorModel);
+    endTrace(t);
+    useGpuSkinning = gpuSkinning;
+    poseTick = -1;
+}
+
+//------Draws the floor and model into the current framebuffer---------
+void drawScene()
+{
+    profileFrame(&profiler);   //A frame starts with its drawing; its animation was timed in the previous one
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    viewPosn = (drawnFrame != NULL) ? drawnFrame->modelPosn : modelPosn;
+    if(viewPosn.z > (2500 * floor_shift)) {   //Extend the floor ahead of the model
+        floor_shift++;
+        z_floor_far += 7500;
+    }
 
+    // scale the whole asset to fit into our view frustum 
+    float tmp = scene_max.x - scene_min.x;
+    tmp = aisgl_max(scene_max.y - scene_min.y,tmp);
+    tmp = aisgl_max(scene_max.z - scene_min.z,tmp);
+    tmp = 1.f / tmp;
+
+    // the camera follows the model; its position is in model units, hence the scale factor
+    aiVector3D follow = viewPosn * tmp;
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
-    gluLookAt(eye_x, eye_y, eye_z + (z_model * 0.00165) ,  look_x, look_y, look_z + (z_model * 0.00165),  0, 1, 0);
+    gluLookAt(eye_x + follow.x, eye_y, eye_z + follow.z,  look_x + follow.x, look_y, look_z + follow.z,  0, 1, 0);
     //gluLookAt(eye_x, eye_y, eye_z,  look_x, look_y, look_z,   0, 1, 0);
     
     glLightfv(GL_LIGHT0, GL_POSITION, lightPosn);
@@ -410,11 +734,6 @@ void display()
     //glRotatef(angle, 0.f, 1.f ,0.f);  //Continuous rotation about the y-axis
     //if(modelRotn) glRotatef(-90, 1, 0, 0);        //First, rotate the model about x-axis if needed.
 
-    // scale the whole asset to fit into our view frustum 
-    float tmp = scene_max.x - scene_min.x;
-    tmp = aisgl_max(scene_max.y - scene_min.y,tmp);
-    tmp = aisgl_max(scene_max.z - scene_min.z,tmp);
-    tmp = 1.f / tmp;
     glScalef(tmp, tmp, tmp);
 
     float xc = (scene_min.x + scene_max.x)*0.5;
@@ -426,16 +745,44 @@ void display()
     //glDisable(GL_TEXTURE_2D);
     glPushMatrix();
     glScalef(2, 1, 2);
+    profileMark m = beginProfile(&profiler, PROFILE_FLOOR);
     drawFloor();
+    endProfile(&profiler, m);
     glPopMatrix();
     
-    glPushMatrix();
-    glTranslatef(0, 0, z_model);
-    glRotatef(-90, 1.0f, 0 ,0);  
-    render(modelScene, modelScene->mRootNode);
-    glPopMatrix();
-    
+    if(crowdData.nInstances > 0) drawCrowd(tmp);
+    else if(drawnFrame != NULL) {   //The animation thread skins at the requested level from its next frame
+        pipeline.requestedLod = lodAt(viewPosn, tmp);
+        drawCharacter(viewPosn);
+    }
+    else {
+        setModelLod(lodAt(viewPosn, tmp));
+        restoreSkinnedVertices();
+        drawCharacter(viewPosn);
+    }
+}
+
+//------The main display function---------
+void display()
+{
+    traceMark t = beginTrace("display");
+    if(usePipeline) {
+        drawnFrame = acquireFrame(&pipeline, false);
+        if(drawnFrame == NULL) {   //No frame skinned yet
+            endTrace(t);
+            return;
+        }
+    }
+    drawScene();
+    traceMark c = beginTrace("capture");
+    captureFrame(&capture);
+    endTrace(c);
+    if(profiler.hud) drawProfileHud(&profiler, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+    profileMark m = beginProfile(&profiler, PROFILE_SWAP);
     glutSwapBuffers();
+    endProfile(&profiler, m);
+    if(usePipeline) framePresented(&pipeline);
+    endTrace(t);
 }
 
 void special(int key, int x, int y)
@@ -456,10 +803,423 @@ void special(int key, int x, int y)
     glutPostRedisplay();
 }
 
+//----Window closed: stops a capture while its GL context is still current----
+void closeWindow()
+{
+    if(capture.active) stopCapture(&capture);
+}
+
+
+
+//----Animation thread: steps and skins the next frame at the level requested by the renderer----
+void animateFrame(frameSlot* slot)
+{
+    setModelLod(pipeline.requestedLod);
+    stepAnimation();
+    restoreSkinnedVertices();
+    slot->lod = currentLod;
+    slot->modelPosn = modelPosn;
+}
+
+//----Starts the animation thread, paced by the timer (window) or as fast as frames are taken (benchmark); not with a crowd, whose poses are evaluated while drawing----
+void startPipeline(bool paced)
+{
+    if(!usePipeline) return;
+    if(crowdData.nInstances > 0) {
+        cout << "Pipeline: not available with a crowd" << endl;
+        usePipeline = false;
+        return;
+    }
+    createFramePipeline(&pipeline, &modelArena, skinData, modelScene->mNumMeshes, modelScene->mRootNode);
+    pipeline.requestedLod = currentLod;
+    startFramePipeline(&pipeline, animateFrame, paced);
+}
+
+void drawPipelinedFrame(const frameSlot* slot)
+{
+    drawnFrame = slot;
+    drawScene();
+}
+
+//------Headless mode: plays the clip in an offscreen context and writes every frame to disk------
+int renderHeadless(const char* prefix, int nFrames, int width, int height, bool raw)
+{
+    offscreenTarget ot;
+    frameOutput out;
+    if(!createOffscreenContext(&ot, width, height)) return 1;
+    if(!openFrameOutput(&out, prefix, raw)) return 1;
+
+    initialise();
+    setupCrowd();
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(35, (float)width / height, 1.0, 1000.0);
+    if(nFrames <= 0) nFrames = animationScene->mAnimations[0]->mDuration + 1;   //Default: one full cycle of the clip
+
+    renderFrames(&ot, &out, nFrames, stepAnimation, drawScene);
+    if(crowdData.nInstances > 0) printPoseCacheStats(&poses, crowdData.nInstances);
+    closeFrameOutput(&out, width, height);
+    closeProfiler(&profiler);
+    destroyOffscreenContext(&ot);
+    unloadModel();
+    return 0;
+}
+
+//------Headless benchmark: frame time at each level of detail------
+int benchmarkLods(int nFrames, int width, int height)
+{
+    offscreenTarget ot;
+    if(!createOffscreenContext(&ot, width, height)) return 1;
+
+    initialise();
+    setupCrowd();
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(35, (float)width / height, 1.0, 1000.0);
+    if(nFrames <= 0) nFrames = 200;
+
+    benchmarkFrames(TRIPWIRE_WARMUP_FRAMES, stepAnimation, drawScene);
+    armTripwire();
+    for (int level = 0; level < MAX_LODS; level++)
+    {
+        forcedLod = level;
+        int nVertices = 0, nFaces = 0;
+        for (int i = 0; i < modelScene->mNumMeshes; i++)
+        {
+            int meshLevel = aisgl_min(level, lodData[i].nLods - 1);
+            nVertices += lodData[i].nVertices[meshLevel];
+            nFaces += lodData[i].nFaces[meshLevel];
+        }
+        double ms = benchmarkFrames(nFrames, stepAnimation, drawScene);
+        cout << "LOD " << level << ": " << nVertices << " vertices, " << nFaces << " faces, "
+            << skel.lodNodes[aisgl_min(level, skel.nLods - 1)] << " nodes, " << ms << " ms/frame" << endl;
+    }
+    bool ok = checkTripwire("lod benchmark");
+    if(crowdData.nInstances > 0) printPoseCacheStats(&poses, crowdData.nInstances);
+    closeProfiler(&profiler);
+    destroyOffscreenContext(&ot);
+    unloadModel();
+    return ok ? 0 : 1;
+}
+
+//------Headless benchmark: animation and rendering in sequence, then pipelined------
+int benchmarkPipeline(int nFrames, int width, int height)
+{
+    offscreenTarget ot;
+    if(!createOffscreenContext(&ot, width, height)) return 1;
+
+    initialise();
+    setupCrowd();
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(35, (float)width / height, 1.0, 1000.0);
+    if(nFrames <= 0) nFrames = 200;
+
+    benchmarkFrames(TRIPWIRE_WARMUP_FRAMES, stepAnimation, drawScene);
+    armTripwire();
+    double sequential = benchmarkFrames(nFrames, stepAnimation, drawScene);
+    bool ok = checkTripwire("sequential");
+    usePipeline = true;
+    startPipeline(false);
+    if(!usePipeline) {
+        closeProfiler(&profiler);
+        destroyOffscreenContext(&ot);
+        unloadModel();
+        return 1;
+    }
+    runPipelinedFrames(&pipeline, TRIPWIRE_WARMUP_FRAMES, drawPipelinedFrame);
+    armTripwire();
+    double pipelined = runPipelinedFrames(&pipeline, nFrames, drawPipelinedFrame);
+    ok = checkTripwire("pipelined") && ok;
+    stopFramePipeline(&pipeline);
+    cout << "Sequential: " << sequential << " ms/frame (latency " << sequential << " ms)" << endl;
+    cout << "Pipelined: " << pipelined << " ms/frame (" << sequential / pipelined << "x throughput)" << endl;
+    printPipelineStats(&pipeline);
+    closeProfiler(&profiler);
+    destroyOffscreenContext(&ot);
+    unloadModel();
+    return ok ? 0 : 1;
+}
+
+//------Headless benchmark: median time per tick of sampling, hierarchy and skinning (a scaling point with --synthetic)------
+int benchmarkStages(const char* csvFile, int nFrames)
+{
+    offscreenTarget ot;
+    if(!createOffscreenContext(&ot, 64, 64)) return 1;
+    initialise();
+    setModelLod(0);
+    if(nFrames <= 0) nFrames = 2 * PROFILE_WINDOW;
+
+    const aiAnimation* clip = animationScene->mAnimations[0];
+    profiler.enabled = true;
+    for (int f = 0; f < nFrames + PROFILE_LATENCY; f++)
+    {
+        if(f == TRIPWIRE_WARMUP_FRAMES) armTripwire();
+        updateNodeMatrices(f % aisgl_max((int)clip->mDuration, 1));
+        profileFrame(&profiler);
+    }
+    bool ok = checkTripwire("stage benchmark");
+    writeScalingRow(csvFile, skinData, modelScene->mNumMeshes, &skel, clip, profilePercentile(&profiler, false, PROFILE_SAMPLE, 50),
+        profilePercentile(&profiler, false, PROFILE_HIERARCHY, 50), profilePercentile(&profiler, false, PROFILE_SKIN, 50));
+    closeProfiler(&profiler);
+    destroyOffscreenContext(&ot);
+    unloadModel();
+    return ok ? 0 : 1;
+}
+
+//------Verification: each optimised engine against a plain reference (key search, parent walks, per-weight skinning)------
+void resetPose()
+{
+    poseTick = -1;
+    poseClip = NULL;
+    markSkeletonDirty(&skel);
+}
+
+//----Reference: every bound channel by the original key search, then referenceSkin() over the whole skeleton and meshes----
+void referencePose(int tick)
+{
+    clipInfo* ci = &runInfo;
+    rootMotion* motion = &runMotion;
+    channelSampler* sampler = &runSampler;
+    sampleChannelsScalar(sampler, ci->bound, ci->nBound, tick, motion);
+    for (int c = 0; c < ci->nBound; c++) setNodeTransform(&skel, ci->node[ci->bound[c]], sampler->local[c]);
+    referenceSkin(&skel, skinData, modelScene->mNumMeshes);
+}
+
+void fullPose(int tick)
+{
+    resetPose();
+    updateNodeMatrices(tick);
+}
+
+//----Full pose with the original per-channel sampling (key search, slerp) instead of the batched sampler----
+void scalarSamplerPose(int tick)
+{
+    scalarSampling = true;
+    fullPose(tick);
+    scalarSampling = false;
+}
+
+//----Full pose with every blended vertex skinned by skinBlendedGeneric() instead of the fixed-width kernels----
+void genericKernelsPose(int tick)
+{
+    skinGenericKernels = true;
+    for (int i = 0; i < modelScene->mNumMeshes; i++) chooseSkinKernels(&skinData[i]);
+    fullPose(tick);
+    skinGenericKernels = false;
+    for (int i = 0; i < modelScene->mNumMeshes; i++) chooseSkinKernels(&skinData[i]);
+}
+
+poseEngine engines[] = {
+    { "reference", referencePose, true },
+    { "incremental", updateNodeMatrices, true },  //Changed channels, nodes and vertices only
+    { "full", fullPose, true },                   //Every bound channel, node and vertex on every tick
+    { "scalar-sampler", scalarSamplerPose, true },
+    { "generic-kernels", genericKernelsPose, true },
+};
+int nEngines = sizeof(engines) / sizeof(engines[0]);
+
+//----Checks one candidate engine, or every one ("all"), against the reference----
+int verifyEngines(const char* candidateName, const char* goldenPrefix, bool writeGolden)
+{
+    bool all = (strcmp(candidateName, "all") == 0);
+    int nCandidates = 0;
+    for (int e = 1; e < nEngines; e++)
+        if(all || strcmp(engines[e].name, candidateName) == 0) nCandidates++;
+    if(nCandidates == 0) {
+        cout << "Verify: unknown engine " << candidateName << " (candidates: all";
+        for (int e = 1; e < nEngines; e++) cout << " " << engines[e].name;
+        cout << ")" << endl;
+        return 1;
+    }
+    offscreenTarget ot;
+    if(!createOffscreenContext(&ot, 64, 64)) return 1;
+    initialise();
+    setModelLod(0);
+
+    verifyTarget vt = { &skel, skinData, (int)modelScene->mNumMeshes, (scene_max - scene_min).Length(), resetPose };
+    const aiAnimation* clip = animationScene->mAnimations[0];
+    string golden = (goldenPrefix != NULL) ? string(goldenPrefix) + "_run.golden" : "";
+    bool ok = true, goldenDone = false;   //The golden file holds the reference poses: checked with the first candidate only
+    for (int e = 1; e < nEngines; e++)
+    {
+        if(!all && strcmp(engines[e].name, candidateName) != 0) continue;
+        verifyReport vr;
+        ok = verifyClip(&vr, &vt, "run", (int)clip->mDuration, &engines[0], &engines[e],
+            goldenPrefix != NULL && !goldenDone ? golden.c_str() : NULL, writeGolden) && ok;
+        printVerifyReport(&vr, "run", &engines[0], &engines[e]);
+        goldenDone = true;
+    }
+    closeProfiler(&profiler);
+    destroyOffscreenContext(&ot);
+    unloadModel();
+    return ok ? 0 : 1;
+}
+
+//------Headless benchmark: skinned vertex formats, float against quantized (bytes, pose, skinning and upload time per frame, error)------
+int benchmarkOutputs(int nFrames)
+{
+    offscreenTarget ot;
+    if(!createOffscreenContext(&ot, 64, 64)) return 1;
+    initialise();
+    setModelLod(0);
+    if(nFrames <= 0) nFrames = 200;
+
+    bool ok = benchmarkSkinOutputs(skinData, modelScene->mNumMeshes, &skel, &modelArena, (int)animationScene->mAnimations[0]->mDuration, nFrames,
+        updateNodeMatrices, fullPose, (scene_max - scene_min).Length());
+    closeProfiler(&profiler);
+    destroyOffscreenContext(&ot);
+    unloadModel();
+    return ok ? 0 : 1;
+}
+
+//------Headless benchmark: CPU skinning and immediate mode against skinning in the vertex shader, then the same pose drawn both ways------
+int benchmarkGpuSkinning(int nFrames, int width, int height)
+{
+    offscreenTarget ot;
+    if(!createOffscreenContext(&ot, width, height)) return 1;
+
+    useGpuSkinning = false;   //Set up once the CPU path is timed
+    initialise();
+    setupCrowd();
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(35, (float)width / height, 1.0, 1000.0);
+    if(nFrames <= 0) nFrames = 200;
+
+    benchmarkFrames(TRIPWIRE_WARMUP_FRAMES, stepAnimation, drawScene);
+    armTripwire();
+    double cpu = benchmarkFrames(nFrames, stepAnimation, drawScene);
+    bool ok = checkTripwire("CPU skinning");
+    useGpuSkinning = setupGpuSkinning();
+    if(useGpuSkinning) {
+        benchmarkFrames(TRIPWIRE_WARMUP_FRAMES, stepAnimation, drawScene);
+        gpuSkin.paletteBytes = 0;
+        gpuSkin.nUploads = 0;
+        armTripwire();
+        double gpu = benchmarkFrames(nFrames, stepAnimation, drawScene);
+        ok = checkTripwire("GPU skinning") && ok;
+        cout << "CPU skinning: " << cpu << " ms/frame" << endl;
+        cout << "GPU skinning: " << gpu << " ms/frame (" << cpu / gpu << "x), palette uploads "
+            << gpuSkin.paletteBytes / 1024.0 / nFrames << " KB/frame (" << gpuSkin.nUploads / nFrames << " draws)" << endl;
+
+        //The current pose, re-skinned on the CPU, then drawn by the shader
+        useGpuSkinning = false;
+        markSkeletonDirty(&skel);
+        transformVertices();
+        drawScene();
+        readOffscreenFrame(&ot);
+        vector<unsigned char> cpuFrame(ot.pixels, ot.pixels + 3 * width * height);
+        useGpuSkinning = true;
+        drawScene();
+        readOffscreenFrame(&ot);
+        ok = checkGpuFrame(cpuFrame.data(), ot.pixels, width * height) && ok;
+        for (int i = 0; i < modelScene->mNumMeshes; i++) releaseGpuSkinnedMesh(&gpuMeshes[i]);
+        destroyGpuSkinner(&gpuSkin);
+    }
+    else ok = false;
+    closeProfiler(&profiler);
+    destroyOffscreenContext(&ot);
+    unloadModel();
+    return ok ? 0 : 1;
+}
 
+//------Reload test: loads and releases the model repeatedly; the resident size should not grow after the first cycle------
+int reloadAssets(int nCycles)
+{
+    size_t first = 0, last = 0;
+    for (int c = 0; c < nCycles; c++)
+    {
+        loadModel("mannequin.fbx");
+        loadAnimation("run.fbx");
+        if(c == 0) printAssetMemory();
+        unloadModel();
+        last = residentBytes();
+        if(c == 0) first = last;
+    }
+    cout << "Reload: " << nCycles << " cycles, resident size " << first / 1024 << " KB after the first, "
+        << last / 1024 << " KB after the last" << endl;
+    return 0;
+}
 
+//  Crowd options (any mode): [--crowd n [--phases k] [--quantize q]] [--bake-vat <file> | --vat <file>] [--impostors] [--profile <csv file>] [--counters] [--trace <json file>]
+//  Model option (any mode): [--synthetic vertices=n,bones=n,depth=n,influences=n,keys=n,ticks=n] (generated instead of loaded)
+//  Window and headless options: [--gpu-skinning] (in the vertex shader; not with the pipeline, --verify or the stage and vertex format benchmarks)
+//  Window options: [--pipeline] (animation and skinning on a separate thread)
+//  The benchmarks fail if anything is allocated after their warm-up frames (the offending stacks are printed).
+//  Usage: MannequinProgram [--headless <output prefix> [--frames n] [--size w h] [--raw] [--lod n]] | --lod-bench [--frames n] [--size w h] | --pipeline-bench [--frames n] [--size w h] | --analyse <clip file>
+//         | --verify <engine> | all [--golden <prefix> | --write-golden <prefix>] (checks an engine against the reference on every tick of each clip)
+//         | --stage-bench <csv file> [--frames n] (appends the stage times; sweep an axis with --synthetic)
+//         | --quant-bench [--frames n] (bytes, skinning and upload time per frame of the float and quantized vertex formats, with their error)
+//         | --gpu-bench [--frames n] [--size w h] (frame time with CPU and GPU skinning, palette bytes per frame, image check)
+//         | --reload <n> (loads and releases the model n times, reporting the memory held)
+//         | --xform-bench (times the SIMD transform primitives against assimp's)
+//         | --sampler-bench <clip file> (channels per second of the batched sampler against the scalar one, e.g. Dance.bvh)
 int main(int argc, char** argv)
 {
+    const char* headlessPrefix = NULL;
+    int nFrames = 0, width = 600, height = 600;
+    bool raw = false, lodBench = false, pipelineBench = false, quantBench = false, gpuBench = false, writeGolden = false;
+    const char* verifyEngine = NULL;
+    const char* goldenPrefix = NULL;
+    const char* stageBenchFile = NULL;
+    int reloadCycles = 0;
+    const char* traceFile = getenv("TRACE_FILE");   //Timeline trace (chrome://tracing, Perfetto), written at exit
+    for (int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--headless") == 0 && i + 1 < argc) headlessPrefix = argv[++i];
+        else if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc) nFrames = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--size") == 0 && i + 2 < argc) {
+            width = atoi(argv[++i]);
+            height = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--raw") == 0) raw = true;
+        else if(strcmp(argv[i], "--lod") == 0 && i + 1 < argc) forcedLod = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--lod-bench") == 0) lodBench = true;
+        else if(strcmp(argv[i], "--pipeline-bench") == 0) pipelineBench = true;
+        else if(strcmp(argv[i], "--pipeline") == 0) usePipeline = true;
+        else if(strcmp(argv[i], "--crowd") == 0 && i + 1 < argc) crowdSize = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--phases") == 0 && i + 1 < argc) crowdPhases = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--quantize") == 0 && i + 1 < argc) crowdQuantum = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--bake-vat") == 0 && i + 1 < argc) vatBakeFile = argv[++i];
+        else if(strcmp(argv[i], "--vat") == 0 && i + 1 < argc) vatLoadFile = argv[++i];
+        else if(strcmp(argv[i], "--impostors") == 0) useImpostors = true;
+        else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc) profileFile = argv[++i];
+        else if(strcmp(argv[i], "--counters") == 0) useCounters = true;
+        else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc) traceFile = argv[++i];
+        else if(strcmp(argv[i], "--synthetic") == 0 && i + 1 < argc) {
+            if(!parseSyntheticSpec(&synthetic, argv[++i])) return 1;
+            useSynthetic = true;
+        }
+        else if(strcmp(argv[i], "--stage-bench") == 0 && i + 1 < argc) stageBenchFile = argv[++i];
+        else if(strcmp(argv[i], "--quant-bench") == 0) quantBench = true;
+        else if(strcmp(argv[i], "--gpu-skinning") == 0) useGpuSkinning = true;
+        else if(strcmp(argv[i], "--gpu-bench") == 0) gpuBench = true;
+        else if(strcmp(argv[i], "--reload") == 0 && i + 1 < argc) reloadCycles = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--verify") == 0 && i + 1 < argc) verifyEngine = argv[++i];
+        else if(strcmp(argv[i], "--golden") == 0 && i + 1 < argc) goldenPrefix = argv[++i];
+        else if(strcmp(argv[i], "--write-golden") == 0 && i + 1 < argc) {
+            goldenPrefix = argv[++i];
+            writeGolden = true;
+        }
+        else if(strcmp(argv[i], "--analyse") == 0 && i + 1 < argc) return analyseClipFile(argv[++i]);
+        else if(strcmp(argv[i], "--xform-bench") == 0) return benchmarkTransforms();
+        else if(strcmp(argv[i], "--sampler-bench") == 0 && i + 1 < argc) return benchmarkSampler(argv[++i]);
+    }
+    if(useGpuSkinning && (usePipeline || pipelineBench || verifyEngine != NULL || stageBenchFile != NULL || quantBench)) {
+        cout << "GPU skinning: not with the pipeline, --verify, --stage-bench or --quant-bench (skinned on the CPU)" << endl;
+        useGpuSkinning = false;
+    }
+    if(traceFile != NULL) startTrace(traceFile);
+    if(stageBenchFile != NULL) return benchmarkStages(stageBenchFile, nFrames);
+    if(quantBench) return benchmarkOutputs(nFrames);
+    if(gpuBench) return benchmarkGpuSkinning(nFrames, width, height);
+    if(reloadCycles > 0) return reloadAssets(reloadCycles);
+    if(verifyEngine != NULL) return verifyEngines(verifyEngine, goldenPrefix, writeGolden);
+    if(lodBench) return benchmarkLods(nFrames, width, height);
+    if(pipelineBench) return benchmarkPipeline(nFrames, width, height);
+    if(headlessPrefix != NULL) return renderHeadless(headlessPrefix, nFrames, width, height, raw);
+
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
     glutInitWindowSize(600, 600);
@@ -468,12 +1228,17 @@ int main(int argc, char** argv)
     glutInitContextProfile ( GLUT_CORE_PROFILE );
 
     initialise();
+    setupCrowd();
+    startPipeline(true);
     glutDisplayFunc(display);
     glutTimerFunc(timeStep, update, 0);
     glutKeyboardFunc(keyboard);
     glutSpecialFunc(special);
+    glutCloseFunc(closeWindow);
+    glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);   //So the worker is stopped below
     glutMainLoop();
 
-    aiReleaseImport(modelScene);
+    stopFramePipeline(&pipeline);
+    unloadModel();
 }
 
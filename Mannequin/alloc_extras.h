@@ -0,0 +1,134 @@
+// ----------------------------------------------------------------------------
+// Allocation tripwire helper functions
+//
+// The global operator new / delete are replaced to count every C++ heap
+// allocation in the process, on any thread (including those made by the
+// standard library, and by the GL driver's own C++ code). Benchmarks arm the
+// tripwire once warm-up is over: the steady-state update, skinning and render
+// loop must not allocate, so each allocation made while it is armed is counted
+// and the first few print the size and the stack of the call site (link with
+// -rdynamic for function names, or resolve the addresses with addr2line).
+// checkTripwire() then reports them and fails the benchmark. C allocations
+// (malloc, stdio) are not counted.
+//-----------------------------------------------------------------------------
+
+#include <atomic>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#ifdef __linux__
+#include <execinfo.h>
+#endif
+
+#define TRIPWIRE_WARMUP_FRAMES 10    //Frames run before arming (first-use allocations)
+#define TRIPWIRE_MAX_REPORTS 4       //Allocations whose stack is printed
+#define TRIPWIRE_STACK_DEPTH 24
+
+struct allocTripwire
+{
+	std::atomic<bool> armed;
+	std::atomic<long> count;      //Allocations while armed
+	std::atomic<long> bytes;
+	std::atomic<int> reported;
+};
+
+allocTripwire tripwire;
+thread_local bool tripwireBusy = false;   //Reporting: allocations made by the report itself are ignored
+
+// ----------------------------------------------------------------------------
+void tripwireAllocation(size_t size)
+{
+	if (!tripwire.armed.load(std::memory_order_relaxed) || tripwireBusy) return;
+	tripwire.count++;
+	tripwire.bytes += size;
+	if (tripwire.reported.fetch_add(1) >= TRIPWIRE_MAX_REPORTS) return;
+	tripwireBusy = true;
+	fprintf(stderr, "Tripwire: allocation of %zu bytes after warm-up, at:\n", size);
+#ifdef __linux__
+	void* frames[TRIPWIRE_STACK_DEPTH];
+	int n = backtrace(frames, TRIPWIRE_STACK_DEPTH);
+	backtrace_symbols_fd(frames + 1, n - 1, 2);   //Without tripwireAllocation() itself
+#endif
+	fflush(stderr);
+	tripwireBusy = false;
+}
+
+// ----------------------------------------------------------------------------
+void* operator new(size_t size)
+{
+	tripwireAllocation(size);
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == NULL) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	tripwireAllocation(size);
+	return malloc(size > 0 ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& nt) noexcept
+{
+	return operator new(size, nt);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+
+// ----------------------------------------------------------------------------
+// Starts counting from zero (after the warm-up frames)
+void armTripwire()
+{
+#ifdef __linux__
+	void* frames[1];
+	backtrace(frames, 1);         //Loads the unwinder now, not in the middle of a report
+#endif
+	tripwire.count = 0;
+	tripwire.bytes = 0;
+	tripwire.reported = 0;
+	tripwire.armed = true;
+}
+
+// ----------------------------------------------------------------------------
+void disarmTripwire()
+{
+	tripwire.armed = false;
+}
+
+// ----------------------------------------------------------------------------
+// Disarms the tripwire and reports; returns false if anything was allocated while armed
+bool checkTripwire(const char* phase)
+{
+	disarmTripwire();
+	long count = tripwire.count;
+	if (count == 0)
+	{
+		cout << "Tripwire (" << phase << "): no allocation after warm-up" << endl;
+		return true;
+	}
+	cout << "Tripwire (" << phase << "): FAILED, " << count << " allocations (" << tripwire.bytes << " bytes) after warm-up" << endl;
+	return false;
+}
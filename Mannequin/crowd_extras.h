@@ -0,0 +1,166 @@
+// ----------------------------------------------------------------------------
+// Crowd helper functions
+//
+// A crowd is a grid of instances of the model playing the current clip, each
+// with its own tick offset (phase) and level of detail. Poses are shared
+// through a cache keyed by (clip, quantised tick, level of detail): an entry
+// holds the local and global matrices of the evaluated skeleton nodes, so an
+// instance that hits it needs no sampling and no hierarchy pass. Instances are
+// drawn grouped by key, so the vertices of each distinct pose are skinned once.
+// With every instance in lockstep, the crowd costs one pose and one skinning
+// pass per frame plus the drawing.
+//-----------------------------------------------------------------------------
+
+#define POSE_CACHE_SIZE 64
+
+struct crowdInstance
+{
+	aiVector3D offset;        //Position relative to the lead character (model units)
+	int phase;                //Tick offset into the clip
+	int tick;                 //Quantised tick and level of detail in the current frame
+	int lod;
+};
+
+struct crowd
+{
+	int nInstances;
+	crowdInstance* instances;
+	int* order;               //Instances sorted by (level of detail, tick)
+};
+
+struct poseKey
+{
+	const aiAnimation* clip;
+	int tick;
+	int lod;
+};
+
+struct poseCache
+{
+	int nNodes;               //Skeleton nodes stored per entry
+	int nEntries;
+	poseKey keys[POSE_CACHE_SIZE];
+	int lastUsed[POSE_CACHE_SIZE];   //Frame of last use (least recently used entry is replaced)
+	aiMatrix4x4* locals;      //POSE_CACHE_SIZE x nNodes
+	aiMatrix4x4* globals;
+	int quantum;              //Ticks are rounded down to a multiple of this
+	int frame;
+	long nLookups, nHits;
+};
+
+// ----------------------------------------------------------------------------
+// Lays out n instances on a grid behind the lead character (instance 0).
+// With nPhases > 1, the instances cycle through nPhases evenly spaced tick offsets.
+void createCrowd(crowd* cr, int n, float spacing, int nPhases, int duration)
+{
+	int nColumns = (int)ceil(sqrt((float)n));
+	cr->nInstances = n;
+	cr->instances = new crowdInstance[n];
+	cr->order = new int[n];
+	for (int i = 0; i < n; i++)
+	{
+		int row = i / nColumns, col = i % nColumns;
+		cr->instances[i].offset = aiVector3D((col - (nColumns - 1) * 0.5f) * spacing, 0, -row * spacing);
+		cr->instances[i].phase = (nPhases > 1) ? (i % nPhases) * duration / nPhases : 0;
+		cr->instances[i].tick = cr->instances[i].lod = 0;
+		cr->order[i] = i;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Sorts the instances by level of detail, then tick, so that equal keys are adjacent
+void sortCrowd(crowd* cr)
+{
+	const crowdInstance* inst = cr->instances;
+	std::sort(cr->order, cr->order + cr->nInstances, [inst](int a, int b) {
+		if (inst[a].lod != inst[b].lod) return inst[a].lod < inst[b].lod;
+		return inst[a].tick < inst[b].tick;
+	});
+}
+
+// ----------------------------------------------------------------------------
+void createPoseCache(poseCache* pc, int nNodes, int quantum)
+{
+	pc->nNodes = nNodes;
+	pc->nEntries = 0;
+	pc->locals = new aiMatrix4x4[POSE_CACHE_SIZE * nNodes];
+	pc->globals = new aiMatrix4x4[POSE_CACHE_SIZE * nNodes];
+	pc->quantum = aisgl_max(quantum, 1);
+	pc->frame = 0;
+	pc->nLookups = pc->nHits = 0;
+}
+
+int quantizeTick(const poseCache* pc, int tick)
+{
+	return tick - tick % pc->quantum;
+}
+
+// ----------------------------------------------------------------------------
+// Returns the entry holding the pose, or -1 on a miss. The statistics count
+// per instance: on a miss, all but the first of nInstances share the new pose.
+int findPose(poseCache* pc, poseKey key, int nInstances)
+{
+	pc->nLookups += nInstances;
+	for (int e = 0; e < pc->nEntries; e++)
+	{
+		if (pc->keys[e].clip == key.clip && pc->keys[e].tick == key.tick && pc->keys[e].lod == key.lod)
+		{
+			pc->nHits += nInstances;
+			pc->lastUsed[e] = pc->frame;
+			return e;
+		}
+	}
+	pc->nHits += nInstances - 1;
+	return -1;
+}
+
+// ----------------------------------------------------------------------------
+// Stores the current pose of the skeleton (its evaluated nodes) under the key
+void storePose(poseCache* pc, poseKey key, const skeleton* skel)
+{
+	int e = pc->nEntries;
+	if (e < POSE_CACHE_SIZE) pc->nEntries++;
+	else
+	{
+		e = 0;
+		for (int i = 1; i < POSE_CACHE_SIZE; i++)
+			if (pc->lastUsed[i] < pc->lastUsed[e]) e = i;
+	}
+	pc->keys[e] = key;
+	pc->lastUsed[e] = pc->frame;
+	aiMatrix4x4* locals = pc->locals + e * pc->nNodes;
+	aiMatrix4x4* globals = pc->globals + e * pc->nNodes;
+	for (int i = 0; i < skel->nActive; i++)
+	{
+		locals[i] = skel->nodes[i]->mTransformation;
+		globals[i] = skel->global[i];
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Loads a cached pose into the skeleton, flagging the nodes whose global matrix
+// changed for skinMesh(), and those left dirty by a level of detail switch
+// (their vertices or palette entries are stale). Returns the number flagged.
+int restorePose(const poseCache* pc, int e, skeleton* skel)
+{
+	const aiMatrix4x4* locals = pc->locals + e * pc->nNodes;
+	const aiMatrix4x4* globals = pc->globals + e * pc->nNodes;
+	int nChanged = 0;
+	for (int i = 0; i < skel->nActive; i++)
+	{
+		skel->nodes[i]->mTransformation = locals[i];
+		skel->changed[i] = skel->dirty[i] || !(skel->global[i] == globals[i]);
+		skel->global[i] = globals[i];
+		skel->dirty[i] = false;
+		if (skel->changed[i]) nChanged++;
+	}
+	return nChanged;
+}
+
+// ----------------------------------------------------------------------------
+void printPoseCacheStats(const poseCache* pc, int nInstances)
+{
+	cout << "Pose cache: " << nInstances << " instances, " << pc->nLookups << " instance poses, " << pc->nHits << " shared ("
+		<< (pc->nLookups > 0 ? 100.0 * pc->nHits / pc->nLookups : 0) << "%), " << pc->nEntries << " entries, quantum "
+		<< pc->quantum << " ticks" << endl;
+}
@@ -0,0 +1,259 @@
+// ----------------------------------------------------------------------------
+// Mesh optimisation helper functions
+//
+// At load, the triangles of each mesh are reordered for post-transform vertex
+// cache reuse (Forsyth's linear-speed algorithm, simulated LRU cache of 32
+// entries), then the vertices are renumbered in the order the triangles first
+// use them. All per-vertex arrays and the bone weights are permuted to match,
+// so that skinning and drawing walk the vertex arrays front to back.
+// Must be called before any copy of the vertex data (initData, skinnedMesh) is made.
+//-----------------------------------------------------------------------------
+
+#define MESH_CACHE_SIZE 32        //Cache modelled by the triangle reordering
+#define MESH_ACMR_CACHE_SIZE 16   //FIFO cache used to report the ACMR
+
+// ----------------------------------------------------------------------------
+// Average cache miss ratio: vertices transformed per triangle, using a FIFO cache.
+// 3 is the worst case; 0.5 - 0.7 is typical of a well ordered mesh.
+float computeACMR(const aiMesh* mesh, int cacheSize = MESH_ACMR_CACHE_SIZE)
+{
+	int* cache = new int[cacheSize];
+	int head = 0, nMisses = 0, nTriangles = 0;
+	for (int i = 0; i < cacheSize; i++) cache[i] = -1;
+
+	for (int k = 0; k < mesh->mNumFaces; k++)
+	{
+		const aiFace* face = &mesh->mFaces[k];
+		if (face->mNumIndices != 3) continue;
+		nTriangles++;
+		for (int i = 0; i < 3; i++)
+		{
+			int v = face->mIndices[i];
+			bool hit = false;
+			for (int c = 0; c < cacheSize && !hit; c++) hit = (cache[c] == v);
+			if (hit) continue;
+			nMisses++;
+			cache[head] = v;
+			head = (head + 1) % cacheSize;
+		}
+	}
+	delete[] cache;
+	return (nTriangles > 0) ? (float)nMisses / nTriangles : 0;
+}
+
+// ----------------------------------------------------------------------------
+// Forsyth vertex score: recently used vertices and vertices with few remaining
+// triangles score higher. The three most recent vertices get a fixed score so
+// that strips of adjacent triangles are not favoured over fans.
+float vertexCacheScore(int cachePosn, int nRemaining)
+{
+	if (nRemaining == 0) return -1.0f;
+	float score = 0;
+	if (cachePosn >= 0)
+	{
+		if (cachePosn < 3) score = 0.75f;
+		else score = powf(1.0f - (float)(cachePosn - 3) / (MESH_CACHE_SIZE - 3), 1.5f);
+	}
+	return score + 2.0f / sqrtf((float)nRemaining);
+}
+
+// ----------------------------------------------------------------------------
+// Reorders the triangles of a triangle mesh. Meshes containing points, lines or
+// polygons are left unchanged.
+void optimizeTriangleOrder(aiMesh* mesh)
+{
+	int nverts = mesh->mNumVertices, ntris = mesh->mNumFaces;
+	for (int k = 0; k < ntris; k++)
+		if (mesh->mFaces[k].mNumIndices != 3) return;
+	if (ntris == 0) return;
+
+	//Vertex -> triangle table
+	int* triStart = new int[nverts + 1];
+	for (int v = 0; v <= nverts; v++) triStart[v] = 0;
+	for (int k = 0; k < ntris; k++)
+		for (int i = 0; i < 3; i++) triStart[mesh->mFaces[k].mIndices[i] + 1]++;
+	for (int v = 0; v < nverts; v++) triStart[v + 1] += triStart[v];
+	int* triList = new int[3 * ntris];
+	int* nRemaining = new int[nverts];
+	for (int v = 0; v < nverts; v++) nRemaining[v] = 0;
+	for (int k = 0; k < ntris; k++)
+		for (int i = 0; i < 3; i++)
+		{
+			int v = mesh->mFaces[k].mIndices[i];
+			triList[triStart[v] + nRemaining[v]++] = k;
+		}
+
+	int* cachePosn = new int[nverts];
+	float* vertScore = new float[nverts];
+	for (int v = 0; v < nverts; v++)
+	{
+		cachePosn[v] = -1;
+		vertScore[v] = vertexCacheScore(-1, nRemaining[v]);
+	}
+	float* triScore = new float[ntris];
+	bool* emitted = new bool[ntris];
+	for (int k = 0; k < ntris; k++)
+	{
+		emitted[k] = false;
+		triScore[k] = 0;
+		for (int i = 0; i < 3; i++) triScore[k] += vertScore[mesh->mFaces[k].mIndices[i]];
+	}
+
+	int cache[MESH_CACHE_SIZE + 3], cacheCount = 0;
+	int* order = new int[ntris];
+	int best = 0;
+	for (int k = 1; k < ntris; k++)
+		if (triScore[k] > triScore[best]) best = k;
+
+	for (int n = 0; n < ntris; n++)
+	{
+		if (best < 0)     //No candidate in the cache: full scan
+		{
+			for (int k = 0; k < ntris; k++)
+				if (!emitted[k] && (best < 0 || triScore[k] > triScore[best])) best = k;
+		}
+		order[n] = best;
+		emitted[best] = true;
+
+		//Remove the triangle from its vertices' lists and move them to the front of the cache
+		int newCache[MESH_CACHE_SIZE + 3], newCount = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			int v = mesh->mFaces[best].mIndices[i];
+			int* tris = triList + triStart[v];
+			for (int t = 0; t < nRemaining[v]; t++)
+				if (tris[t] == best)
+				{
+					tris[t] = tris[--nRemaining[v]];
+					break;
+				}
+			newCache[newCount++] = v;
+		}
+		for (int c = 0; c < cacheCount; c++)
+		{
+			int v = cache[c];
+			if (v != newCache[0] && v != newCache[1] && v != newCache[2]) newCache[newCount++] = v;
+		}
+
+		//Rescore the vertices in (or just evicted from) the cache and their triangles
+		for (int c = 0; c < newCount; c++)
+		{
+			int v = newCache[c];
+			cachePosn[v] = (c < MESH_CACHE_SIZE) ? c : -1;
+			float score = vertexCacheScore(cachePosn[v], nRemaining[v]);
+			float delta = score - vertScore[v];
+			vertScore[v] = score;
+			for (int t = 0; t < nRemaining[v]; t++) triScore[triList[triStart[v] + t]] += delta;
+		}
+		cacheCount = aisgl_min(newCount, MESH_CACHE_SIZE);
+		for (int c = 0; c < cacheCount; c++) cache[c] = newCache[c];
+
+		//Next triangle: the best one using a cached vertex
+		best = -1;
+		for (int c = 0; c < cacheCount; c++)
+		{
+			int v = cache[c];
+			for (int t = 0; t < nRemaining[v]; t++)
+			{
+				int k = triList[triStart[v] + t];
+				if (best < 0 || triScore[k] > triScore[best]) best = k;
+			}
+		}
+	}
+
+	//All faces have three indices, so only the index arrays need to move
+	unsigned int** indices = new unsigned int*[ntris];
+	for (int n = 0; n < ntris; n++) indices[n] = mesh->mFaces[order[n]].mIndices;
+	for (int n = 0; n < ntris; n++) mesh->mFaces[n].mIndices = indices[n];
+	delete[] indices;
+
+	delete[] triStart;
+	delete[] triList;
+	delete[] nRemaining;
+	delete[] cachePosn;
+	delete[] vertScore;
+	delete[] triScore;
+	delete[] emitted;
+	delete[] order;
+}
+
+// ----------------------------------------------------------------------------
+template <class T> void permuteVertexArray(T* data, const int* newIndex, int nverts)
+{
+	if (data == NULL) return;
+	T* tmp = new T[nverts];
+	for (int v = 0; v < nverts; v++) tmp[newIndex[v]] = data[v];
+	for (int v = 0; v < nverts; v++) data[v] = tmp[v];
+	delete[] tmp;
+}
+
+// ----------------------------------------------------------------------------
+// Moves vertex v to newIndex[v] in every vertex attribute and the bone weights.
+// Face indices are not changed.
+void permuteVertices(aiMesh* mesh, const int* newIndex)
+{
+	int nverts = mesh->mNumVertices;
+	permuteVertexArray(mesh->mVertices, newIndex, nverts);
+	permuteVertexArray(mesh->mNormals, newIndex, nverts);
+	permuteVertexArray(mesh->mTangents, newIndex, nverts);
+	permuteVertexArray(mesh->mBitangents, newIndex, nverts);
+	for (int c = 0; c < AI_MAX_NUMBER_OF_TEXTURECOORDS; c++)
+		permuteVertexArray(mesh->mTextureCoords[c], newIndex, nverts);
+	for (int c = 0; c < AI_MAX_NUMBER_OF_COLOR_SETS; c++)
+		permuteVertexArray(mesh->mColors[c], newIndex, nverts);
+	for (int j = 0; j < mesh->mNumBones; j++)
+	{
+		aiBone* bone = mesh->mBones[j];
+		for (int k = 0; k < bone->mNumWeights; k++)
+			bone->mWeights[k].mVertexId = newIndex[bone->mWeights[k].mVertexId];
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Renumbers the vertices in the order of their first use by the faces (unused
+// vertices go last), permuting every vertex attribute and the bone weights.
+void reorderVertices(aiMesh* mesh)
+{
+	int nverts = mesh->mNumVertices;
+	int* newIndex = new int[nverts];
+	for (int v = 0; v < nverts; v++) newIndex[v] = -1;
+	int next = 0;
+	for (int k = 0; k < mesh->mNumFaces; k++)
+	{
+		aiFace* face = &mesh->mFaces[k];
+		for (int i = 0; i < face->mNumIndices; i++)
+		{
+			int v = face->mIndices[i];
+			if (newIndex[v] < 0) newIndex[v] = next++;
+			face->mIndices[i] = newIndex[v];
+		}
+	}
+	for (int v = 0; v < nverts; v++)
+		if (newIndex[v] < 0) newIndex[v] = next++;
+
+	permuteVertices(mesh, newIndex);
+	delete[] newIndex;
+}
+
+// ----------------------------------------------------------------------------
+// Optimises all meshes of a scene and prints the ACMR before and after
+void optimizeMeshes(const aiScene* sc, const char* name)
+{
+	int nTris = 0;
+	float before = 0, after = 0;
+	for (int i = 0; i < sc->mNumMeshes; i++)
+	{
+		aiMesh* mesh = sc->mMeshes[i];
+		float acmr0 = computeACMR(mesh);
+		optimizeTriangleOrder(mesh);
+		reorderVertices(mesh);
+		float acmr1 = computeACMR(mesh);
+		cout << "Mesh " << i << ": " << mesh->mNumVertices << " vertices, " << mesh->mNumFaces
+			<< " faces, ACMR " << acmr0 << " -> " << acmr1 << endl;
+		before += acmr0 * mesh->mNumFaces;
+		after += acmr1 * mesh->mNumFaces;
+		nTris += mesh->mNumFaces;
+	}
+	if (nTris > 0)
+		cout << "Mesh optimisation (" << name << "): ACMR " << before / nTris << " -> " << after / nTris << endl;
+}
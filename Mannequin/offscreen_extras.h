@@ -0,0 +1,223 @@
+// ----------------------------------------------------------------------------
+// Headless rendering helper functions
+//
+// An OpenGL (compatibility profile) context is created through EGL without a
+// window or display server, using the Mesa surfaceless platform when available
+// (llvmpipe on machines without a GPU). Rendering goes to a framebuffer object
+// whose contents are read back and written as PPM images or as one raw RGB24
+// stream. Requires GL_GLEXT_PROTOTYPES before the GL headers, and -lEGL.
+//-----------------------------------------------------------------------------
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+
+struct offscreenTarget
+{
+	EGLDisplay display;
+	EGLContext context;
+	GLuint fbo, colourBuffer, depthBuffer;
+	int width, height;
+	unsigned char* pixels;    //RGB24 readback buffer, top row first
+};
+
+struct frameOutput
+{
+	const char* prefix;       //Output path prefix (images: <prefix>_0000.ppm, raw: <prefix>.rgb)
+	bool raw;                 //Write a single raw RGB24 stream instead of images
+	FILE* stream;
+	int nFrames;
+};
+
+// ----------------------------------------------------------------------------
+bool createOffscreenContext(offscreenTarget* ot, int width, int height)
+{
+	ot->width = width;
+	ot->height = height;
+	ot->display = EGL_NO_DISPLAY;
+
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay != NULL)
+		ot->display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (ot->display == EGL_NO_DISPLAY)
+		ot->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (ot->display == EGL_NO_DISPLAY || !eglInitialize(ot->display, &major, &minor))
+	{
+		cout << "Headless: could not initialise EGL" << endl;
+		return false;
+	}
+
+	const EGLint configAttribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE };
+	EGLConfig config;
+	EGLint nconfigs = 0;
+	eglChooseConfig(ot->display, configAttribs, &config, 1, &nconfigs);
+	eglBindAPI(EGL_OPENGL_API);
+	ot->context = eglCreateContext(ot->display, nconfigs > 0 ? config : (EGLConfig)0, EGL_NO_CONTEXT, NULL);
+	if (ot->context == EGL_NO_CONTEXT ||
+		!eglMakeCurrent(ot->display, EGL_NO_SURFACE, EGL_NO_SURFACE, ot->context))
+	{
+		cout << "Headless: could not create a surfaceless OpenGL context" << endl;
+		return false;
+	}
+
+	glGenFramebuffers(1, &ot->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, ot->fbo);
+	glGenRenderbuffers(1, &ot->colourBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, ot->colourBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ot->colourBuffer);
+	glGenRenderbuffers(1, &ot->depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, ot->depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, ot->depthBuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		cout << "Headless: framebuffer object incomplete" << endl;
+		return false;
+	}
+	glViewport(0, 0, width, height);
+
+	ot->pixels = new unsigned char[width * height * 3];
+	cout << "Headless: " << glGetString(GL_RENDERER) << ", " << width << "x" << height << endl;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+void destroyOffscreenContext(offscreenTarget* ot)
+{
+	glDeleteRenderbuffers(1, &ot->colourBuffer);
+	glDeleteRenderbuffers(1, &ot->depthBuffer);
+	glDeleteFramebuffers(1, &ot->fbo);
+	eglMakeCurrent(ot->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(ot->display, ot->context);
+	eglTerminate(ot->display);
+	delete[] ot->pixels;
+}
+
+// ----------------------------------------------------------------------------
+// Flips an RGB24 image upside down (OpenGL returns the bottom row first)
+void flipRows(unsigned char* rgb, int width, int height)
+{
+	int rowSize = width * 3;
+	for (int top = 0, bottom = height - 1; top < bottom; top++, bottom--)
+		std::swap_ranges(rgb + top * rowSize, rgb + (top + 1) * rowSize, rgb + bottom * rowSize);   //No row buffer to allocate
+}
+
+// ----------------------------------------------------------------------------
+// Reads the framebuffer into ot->pixels, flipping it so that the top row is first
+void readOffscreenFrame(offscreenTarget* ot)
+{
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, ot->width, ot->height, GL_RGB, GL_UNSIGNED_BYTE, ot->pixels);
+	flipRows(ot->pixels, ot->width, ot->height);
+}
+
+// ----------------------------------------------------------------------------
+bool openFrameOutput(frameOutput* out, const char* prefix, bool raw)
+{
+	out->prefix = prefix;
+	out->raw = raw;
+	out->stream = NULL;
+	out->nFrames = 0;
+	if (raw)
+	{
+		char fileName[1024];
+		snprintf(fileName, sizeof(fileName), "%s.rgb", prefix);
+		out->stream = fopen(fileName, "wb");
+		if (out->stream == NULL)
+		{
+			cout << "Headless: could not open " << fileName << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+void writeFrame(frameOutput* out, const unsigned char* rgb, int width, int height)
+{
+	if (out->raw)
+	{
+		fwrite(rgb, 3, width * height, out->stream);
+	}
+	else
+	{
+		char fileName[1024];
+		snprintf(fileName, sizeof(fileName), "%s_%04d.ppm", out->prefix, out->nFrames);
+		FILE* fp = fopen(fileName, "wb");
+		if (fp == NULL)
+		{
+			cout << "Headless: could not open " << fileName << endl;
+			return;
+		}
+		fprintf(fp, "P6\n%d %d\n255\n", width, height);
+		fwrite(rgb, 3, width * height, fp);
+		fclose(fp);
+	}
+	out->nFrames++;
+}
+
+// ----------------------------------------------------------------------------
+void closeFrameOutput(frameOutput* out, int width, int height)
+{
+	if (out->stream != NULL)
+	{
+		fclose(out->stream);
+		cout << "Wrote " << out->nFrames << " frames to " << out->prefix << ".rgb"
+			<< " (ffmpeg -f rawvideo -pix_fmt rgb24 -s " << width << "x" << height << " -i " << out->prefix << ".rgb ...)" << endl;
+	}
+	else
+		cout << "Wrote " << out->nFrames << " frames to " << out->prefix << "_*.ppm" << endl;
+}
+
+// ----------------------------------------------------------------------------
+// Renders nFrames frames as fast as possible: "step" advances the animation by
+// one tick and "draw" renders the scene into the current framebuffer.
+// Prints the throughput, split into animate/render and readback/write time.
+void renderFrames(offscreenTarget* ot, frameOutput* out, int nFrames, void (*step)(), void (*draw)())
+{
+	typedef std::chrono::steady_clock clock;
+	double renderTime = 0, writeTime = 0;
+	clock::time_point start = clock::now();
+
+	for (int f = 0; f < nFrames; f++)
+	{
+		clock::time_point t0 = clock::now();
+		step();
+		draw();
+		glFinish();
+		clock::time_point t1 = clock::now();
+		readOffscreenFrame(ot);
+		writeFrame(out, ot->pixels, ot->width, ot->height);
+		clock::time_point t2 = clock::now();
+		renderTime += std::chrono::duration<double>(t1 - t0).count();
+		writeTime += std::chrono::duration<double>(t2 - t1).count();
+	}
+
+	double total = std::chrono::duration<double>(clock::now() - start).count();
+	cout << "Headless: " << nFrames << " frames in " << total << " s = " << nFrames / total << " fps"
+		<< "  (animate+render " << 1000 * renderTime / nFrames << " ms/frame, readback+write "
+		<< 1000 * writeTime / nFrames << " ms/frame)" << endl;
+}
+
+// ----------------------------------------------------------------------------
+// Renders nFrames frames without reading them back. Returns the mean time per
+// frame (animate + render) in milliseconds.
+double benchmarkFrames(int nFrames, void (*step)(), void (*draw)())
+{
+	typedef std::chrono::steady_clock clock;
+	clock::time_point start = clock::now();
+	for (int f = 0; f < nFrames; f++)
+	{
+		step();
+		draw();
+		glFinish();
+	}
+	return 1000 * std::chrono::duration<double>(clock::now() - start).count() / nFrames;
+}
@@ -0,0 +1,207 @@
+// ----------------------------------------------------------------------------
+// Quantized skinning output helper functions
+//
+// Compares the skinned-vertex formats of skin_extras.h: the float mesh arrays
+// and the quantized streams. For each format, a clip is played with the usual
+// incremental updates, timing the pose and skinning of each frame and the
+// upload of its vertices (the active prefix of every mesh) to a GL buffer
+// object, orphaned every frame as a streamed vertex buffer would be. The
+// quantized streams are then decoded on every tick of the clip and compared
+// with the float path: position error in model units, normal error in
+// degrees. (The fixed-function renderer still draws from the float arrays.)
+//-----------------------------------------------------------------------------
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+struct quantError
+{
+	double maxPosn, sumPosn2;     //Position error (model units)
+	double maxAngle, sumAngle;    //Normal error (degrees)
+	long nVertices, nNormals;
+};
+
+struct uploadTimer
+{
+	GLuint buffer;
+	size_t capacity;              //Bytes of the buffer: every vertex as floats
+	double ms;                    //Upload time since the last reset
+	size_t bytes;
+	int nFrames;
+};
+
+// ----------------------------------------------------------------------------
+void resetQuantError(quantError* qe)
+{
+	qe->maxPosn = qe->sumPosn2 = qe->maxAngle = qe->sumAngle = 0;
+	qe->nVertices = qe->nNormals = 0;
+}
+
+// ----------------------------------------------------------------------------
+// Accumulates the error of n decoded vertices; refNorm is NULL for a mesh without normals
+void addQuantError(quantError* qe, const aiVector3D* refPosn, const aiVector3D* refNorm,
+	const aiVector3D* posn, const aiVector3D* norm, int n)
+{
+	for (int v = 0; v < n; v++)
+	{
+		double e = (posn[v] - refPosn[v]).Length();
+		qe->maxPosn = aisgl_max(qe->maxPosn, e);
+		qe->sumPosn2 += e * e;
+		if (refNorm == NULL) continue;
+		if (refNorm[v].SquareLength() == 0) continue;
+		double angle = atan2((refNorm[v] ^ norm[v]).Length(), refNorm[v] * norm[v]) * 180.0 / AI_MATH_PI_F;   //Accurate for small angles, unlike acos
+		qe->maxAngle = aisgl_max(qe->maxAngle, angle);
+		qe->sumAngle += angle;
+		qe->nNormals++;
+	}
+	qe->nVertices += n;
+}
+
+// ----------------------------------------------------------------------------
+void printQuantError(const quantError* qe, const char* name, float modelSize)
+{
+	double rms = (qe->nVertices > 0) ? sqrt(qe->sumPosn2 / qe->nVertices) : 0;
+	cout << "  Error of " << name << ": position max " << qe->maxPosn << " (" << 100 * qe->maxPosn / modelSize
+		<< "% of the model size), rms " << rms;
+	if (qe->nNormals > 0) cout << "; normal max " << qe->maxAngle << " deg, mean " << qe->sumAngle / qe->nNormals << " deg";
+	cout << endl;
+}
+
+// ----------------------------------------------------------------------------
+void createUploadTimer(uploadTimer* ut, size_t capacity)
+{
+	glGenBuffers(1, &ut->buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, ut->buffer);
+	glBufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	ut->capacity = capacity;
+	ut->ms = 0;
+	ut->bytes = 0;
+	ut->nFrames = 0;
+}
+
+void resetUploadTimer(uploadTimer* ut)
+{
+	ut->ms = 0;
+	ut->bytes = 0;
+	ut->nFrames = 0;
+}
+
+void destroyUploadTimer(uploadTimer* ut)
+{
+	glDeleteBuffers(1, &ut->buffer);
+}
+
+// ----------------------------------------------------------------------------
+void uploadRange(size_t& offset, const void* data, size_t size)
+{
+	glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+	offset += size;
+}
+
+// ----------------------------------------------------------------------------
+// Uploads one frame: the active vertices of every mesh, in its current output format
+void uploadSkinnedFrame(uploadTimer* ut, const skinnedMesh* skinData, int nMeshes)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	glBindBuffer(GL_ARRAY_BUFFER, ut->buffer);
+	glBufferData(GL_ARRAY_BUFFER, ut->capacity, NULL, GL_STREAM_DRAW);   //Orphaned: no wait for the previous frame's draws
+	size_t offset = 0;
+	for (int m = 0; m < nMeshes; m++)
+	{
+		const skinnedMesh* sm = &skinData[m];
+		size_t n = sm->nActive;
+		if (sm->output == SKIN_OUTPUT_FLOAT)
+		{
+			uploadRange(offset, sm->mesh->mVertices, 12 * n);
+			if (sm->normals) uploadRange(offset, sm->mesh->mNormals, 12 * n);
+			continue;
+		}
+		uploadRange(offset, sm->quantPositions, 6 * n);
+		if (sm->normals && sm->output == SKIN_OUTPUT_OCT16) uploadRange(offset, sm->quantNormals16, 4 * n);
+		if (sm->normals && sm->output == SKIN_OUTPUT_OCT8) uploadRange(offset, sm->quantNormals8, 2 * n);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glFinish();
+	ut->ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	ut->bytes += offset;
+	ut->nFrames++;
+}
+
+// ----------------------------------------------------------------------------
+// Plays nFrames ticks of a clip (of nTicks) in each output format, then reports
+// the error of each quantized format over every tick. "pose" is the usual
+// incremental update, "fullPose" re-skins every vertex. Returns false if the
+// steady-state frames allocated (see alloc_extras.h).
+bool benchmarkSkinOutputs(skinnedMesh* skinData, int nMeshes, skeleton* skel, assetArena* arena,
+	int nTicks, int nFrames, void (*pose)(int), void (*fullPose)(int), float modelSize)
+{
+	int nVertices = 0;
+	for (int m = 0; m < nMeshes; m++) nVertices += skinData[m].mesh->mNumVertices;
+	std::vector<aiVector3D> refPosn(nVertices), refNorm(nVertices), posn(nVertices), norm(nVertices);
+	uploadTimer ut;
+	createUploadTimer(&ut, 24 * (size_t)aisgl_max(nVertices, 1));
+	nTicks = aisgl_max(nTicks, 1);
+	bool ok = true;
+
+	for (int format = 0; format < SKIN_OUTPUTS; format++)
+	{
+		for (int m = 0; m < nMeshes; m++) setSkinOutput(&skinData[m], arena, skel, format);
+		double skinMs = 0;
+		int nActive = 0;
+		for (int m = 0; m < nMeshes; m++) nActive += skinData[m].nActive;
+		for (int f = 0; f < TRIPWIRE_WARMUP_FRAMES + nFrames; f++)
+		{
+			if (f == TRIPWIRE_WARMUP_FRAMES)
+			{
+				armTripwire();
+				resetUploadTimer(&ut);
+				skinMs = 0;
+			}
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			pose(f % nTicks);
+			skinMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			uploadSkinnedFrame(&ut, skinData, nMeshes);
+		}
+		ok = checkTripwire(skinOutputNames[format]) && ok;
+		int nRequantized = 0;
+		for (int m = 0; m < nMeshes; m++) nRequantized += skinData[m].nRequantized;
+		double frameBytes = (double)ut.bytes / aisgl_max(ut.nFrames, 1);
+		cout << "Output " << skinOutputNames[format] << ": " << frameBytes / aisgl_max(nActive, 1) << " bytes/vertex, "
+			<< frameBytes / 1024 << " KB/frame; pose and skin " << skinMs / nFrames << " ms/frame, upload "
+			<< ut.ms / aisgl_max(ut.nFrames, 1) << " ms/frame";
+		if (format != SKIN_OUTPUT_FLOAT) cout << " (box grown " << nRequantized << " times)";
+		cout << endl;
+	}
+
+	//Error of the quantized formats, on every tick: float reference, then the decoded stream
+	for (int format = SKIN_OUTPUT_FLOAT + 1; format < SKIN_OUTPUTS; format++)
+	{
+		quantError qe;
+		resetQuantError(&qe);
+		for (int t = 0; t < nTicks; t++)
+		{
+			for (int m = 0; m < nMeshes; m++) setSkinOutput(&skinData[m], arena, skel, SKIN_OUTPUT_FLOAT);
+			fullPose(t);
+			for (int m = 0, offset = 0; m < nMeshes; offset += skinData[m].nActive, m++)
+			{
+				const skinnedMesh* sm = &skinData[m];
+				std::copy(sm->mesh->mVertices, sm->mesh->mVertices + sm->nActive, &refPosn[offset]);
+				if (sm->normals) std::copy(sm->mesh->mNormals, sm->mesh->mNormals + sm->nActive, &refNorm[offset]);
+			}
+			for (int m = 0; m < nMeshes; m++) setSkinOutput(&skinData[m], arena, skel, format);
+			fullPose(t);
+			for (int m = 0, offset = 0; m < nMeshes; offset += skinData[m].nActive, m++)
+			{
+				const skinnedMesh* sm = &skinData[m];
+				decodeSkinnedMesh(sm, &posn[offset], &norm[offset]);
+				addQuantError(&qe, &refPosn[offset], sm->normals ? &refNorm[offset] : NULL, &posn[offset], &norm[offset], sm->nActive);
+			}
+		}
+		printQuantError(&qe, skinOutputNames[format], modelSize);
+	}
+	for (int m = 0; m < nMeshes; m++) setSkinOutput(&skinData[m], arena, skel, SKIN_OUTPUT_FLOAT);
+	destroyUploadTimer(&ut);
+	return ok;
+}
@@ -0,0 +1,318 @@
+// ----------------------------------------------------------------------------
+// Channel sampler helper functions
+//
+// The channels evaluated in a tick are sampled in two passes. The first pass
+// finds the keys around the time for each channel and stores them in
+// structure-of-arrays form. Each channel keeps a cursor on its last key, so
+// playing forwards costs one comparison per track and no key search. The second
+// pass evaluates SAMPLER_WIDTH channels per iteration: positions are
+// interpolated linearly, and rotations by nlerp along the shorter arc with a
+// corrected factor, which follows slerp closely (A. Kapoulkine, "Approximating
+// slerp") without trigonometry. The resulting local transformations are written
+// contiguously, in evaluation order. Before the first key and after the last,
+// a track holds its end value.
+//
+// Eight channels per iteration use AVX when the build enables it, two
+// four-lane halves (xform_extras.h) otherwise. sampleChannelsScalar() is the
+// original per-channel path (key search, aiQuaternion::Interpolate, matrix
+// products) and serves as the reference for benchmarkSampler().
+//-----------------------------------------------------------------------------
+
+#include <cstring>
+#include <chrono>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+#define SAMPLER_WIDTH 8
+
+enum samplerStream { SAMPLE_P0X, SAMPLE_P0Y, SAMPLE_P0Z, SAMPLE_P1X, SAMPLE_P1Y, SAMPLE_P1Z, SAMPLE_TP,
+	SAMPLE_Q0W, SAMPLE_Q0X, SAMPLE_Q0Y, SAMPLE_Q0Z, SAMPLE_Q1W, SAMPLE_Q1X, SAMPLE_Q1Y, SAMPLE_Q1Z, SAMPLE_TR, SAMPLE_STREAMS };
+
+struct channelSampler
+{
+	const clipInfo* ci;
+	int nPadded;                  //Channels rounded up to SAMPLER_WIDTH
+	int* posnCursor;              //Key at or before the last sampled time, per channel
+	int* rotnCursor;
+	float* stream[SAMPLE_STREAMS];  //Bracketing keys and factors, per evaluated channel (nPadded each)
+	aiMatrix4x4* local;           //Local transformation of each evaluated channel (nPadded)
+};
+
+// ----------------------------------------------------------------------------
+// Eight lanes
+#ifdef __AVX__
+typedef __m256 xwide;
+
+inline xwide xwLoad(const float* p) { return _mm256_load_ps(p); }
+inline xwide xwSplat(float f) { return _mm256_set1_ps(f); }
+inline xwide xwAdd(xwide a, xwide b) { return _mm256_add_ps(a, b); }
+inline xwide xwSub(xwide a, xwide b) { return _mm256_sub_ps(a, b); }
+inline xwide xwMul(xwide a, xwide b) { return _mm256_mul_ps(a, b); }
+inline xwide xwDiv(xwide a, xwide b) { return _mm256_div_ps(a, b); }
+inline xwide xwSqrt(xwide v) { return _mm256_sqrt_ps(v); }
+inline xwide xwAbs(xwide v) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v); }
+inline xwide xwFlipSign(xwide v, xwide s) { return _mm256_xor_ps(v, _mm256_and_ps(s, _mm256_set1_ps(-0.0f))); }
+template <int h> inline xvec xwHalf(xwide v) { return h == 0 ? _mm256_castps256_ps128(v) : _mm256_extractf128_ps(v, 1); }
+#else
+struct xwide { xvec h[2]; };
+
+inline xwide xwLoad(const float* p) { xwide r = { { xload(p), xload(p + 4) } }; return r; }
+inline xwide xwSplat(float f) { xwide r = { { xsplat(f), xsplat(f) } }; return r; }
+inline xwide xwAdd(xwide a, xwide b) { xwide r = { { xadd(a.h[0], b.h[0]), xadd(a.h[1], b.h[1]) } }; return r; }
+inline xwide xwSub(xwide a, xwide b) { xwide r = { { xsub(a.h[0], b.h[0]), xsub(a.h[1], b.h[1]) } }; return r; }
+inline xwide xwMul(xwide a, xwide b) { xwide r = { { xmul(a.h[0], b.h[0]), xmul(a.h[1], b.h[1]) } }; return r; }
+inline xwide xwDiv(xwide a, xwide b) { xwide r = { { xdiv(a.h[0], b.h[0]), xdiv(a.h[1], b.h[1]) } }; return r; }
+inline xwide xwSqrt(xwide v) { xwide r = { { xsqrt(v.h[0]), xsqrt(v.h[1]) } }; return r; }
+inline xwide xwAbs(xwide v) { xwide r = { { xabs(v.h[0]), xabs(v.h[1]) } }; return r; }
+inline xwide xwFlipSign(xwide v, xwide s) { xwide r = { { xflipsign(v.h[0], s.h[0]), xflipsign(v.h[1], s.h[1]) } }; return r; }
+template <int h> inline xvec xwHalf(xwide v) { return v.h[h]; }
+#endif
+
+inline xwide xwMadd(xwide a, xwide b, xwide c) { return xwAdd(xwMul(a, b), c); }
+inline xwide xwLerp(xwide a, xwide b, xwide t) { return xwMadd(xwSub(b, a), t, a); }
+
+// ----------------------------------------------------------------------------
+void buildChannelSampler(channelSampler* cs, assetArena* arena, const clipInfo* ci)
+{
+	int n = ci->nChannels;
+	cs->ci = ci;
+	cs->nPadded = (n + SAMPLER_WIDTH - 1) / SAMPLER_WIDTH * SAMPLER_WIDTH;
+	cs->posnCursor = arenaAlloc<int>(arena, ARENA_CLIPS, n);
+	cs->rotnCursor = arenaAlloc<int>(arena, ARENA_CLIPS, n);
+	for (int i = 0; i < n; i++) cs->posnCursor[i] = cs->rotnCursor[i] = 0;
+	for (int s = 0; s < SAMPLE_STREAMS; s++)
+	{
+		cs->stream[s] = arenaAlloc<float>(arena, ARENA_CLIPS, cs->nPadded);
+		float fill = (s == SAMPLE_Q0W || s == SAMPLE_Q1W) ? 1 : 0;   //Unused lanes hold identity rotations
+		for (int c = 0; c < cs->nPadded; c++) cs->stream[s][c] = fill;
+	}
+	cs->local = arenaAlloc<aiMatrix4x4>(arena, ARENA_CLIPS, cs->nPadded);
+}
+
+// ----------------------------------------------------------------------------
+// Moves the cursor to the last key at or before the time (back to the start if
+// the time went backwards) and returns the factor towards the next key
+template <class K> float bracketKeys(const K* keys, int nKeys, int& cursor, double time, int& next)
+{
+	if (cursor >= nKeys || time < keys[cursor].mTime) cursor = 0;
+	while (cursor + 1 < nKeys && keys[cursor + 1].mTime <= time) cursor++;
+	next = aisgl_min(cursor + 1, nKeys - 1);
+	if (next == cursor || time <= keys[cursor].mTime) return 0;
+	return (float)((time - keys[cursor].mTime) / (keys[next].mTime - keys[cursor].mTime));
+}
+
+// ----------------------------------------------------------------------------
+// First pass: the keys of channel i around the time, into lane "slot"
+void gatherChannel(channelSampler* cs, int slot, int i, double time, const rootMotion* motion)
+{
+	const clipInfo* ci = cs->ci;
+	float** s = cs->stream;
+	const aiNodeAnim* channel = ci->posnChannel[i];
+	aiVector3D p0, p1;
+	float tp = 0;
+	if (ci->constPosn[i]) p0 = p1 = channel->mPositionKeys[0].mValue;
+	else
+	{
+		int next;
+		tp = bracketKeys(channel->mPositionKeys, channel->mNumPositionKeys, cs->posnCursor[i], time, next);
+		p0 = channel->mPositionKeys[cs->posnCursor[i]].mValue;
+		p1 = channel->mPositionKeys[next].mValue;
+		if (motion != NULL && i == motion->channel)    //In-place pose; the root motion moves the model instead
+		{
+			aiVector3D offset = rootMotionLocal(motion, (int)time);
+			p0 -= offset;
+			p1 -= offset;
+		}
+	}
+	s[SAMPLE_P0X][slot] = p0.x; s[SAMPLE_P0Y][slot] = p0.y; s[SAMPLE_P0Z][slot] = p0.z;
+	s[SAMPLE_P1X][slot] = p1.x; s[SAMPLE_P1Y][slot] = p1.y; s[SAMPLE_P1Z][slot] = p1.z;
+	s[SAMPLE_TP][slot] = tp;
+
+	channel = ci->anim->mChannels[i];
+	aiQuaternion q0, q1;
+	float tr = 0;
+	if (ci->constRotn[i]) q0 = q1 = channel->mRotationKeys[0].mValue;
+	else
+	{
+		int next;
+		tr = bracketKeys(channel->mRotationKeys, channel->mNumRotationKeys, cs->rotnCursor[i], time, next);
+		q0 = channel->mRotationKeys[cs->rotnCursor[i]].mValue;
+		q1 = channel->mRotationKeys[next].mValue;
+	}
+	s[SAMPLE_Q0W][slot] = q0.w; s[SAMPLE_Q0X][slot] = q0.x; s[SAMPLE_Q0Y][slot] = q0.y; s[SAMPLE_Q0Z][slot] = q0.z;
+	s[SAMPLE_Q1W][slot] = q1.w; s[SAMPLE_Q1X][slot] = q1.x; s[SAMPLE_Q1Y][slot] = q1.y; s[SAMPLE_Q1Z][slot] = q1.z;
+	s[SAMPLE_TR][slot] = tr;
+}
+
+// ----------------------------------------------------------------------------
+// Second pass: local transformations of the first n gathered channels, SAMPLER_WIDTH at a time
+void evaluateSamples(channelSampler* cs, int n)
+{
+	float** s = cs->stream;
+	const xwide one = xwSplat(1), half = xwSplat(0.5f);
+	for (int b = 0; b < n; b += SAMPLER_WIDTH)
+	{
+		xwide tp = xwLoad(s[SAMPLE_TP] + b);
+		xwide px = xwLerp(xwLoad(s[SAMPLE_P0X] + b), xwLoad(s[SAMPLE_P1X] + b), tp);
+		xwide py = xwLerp(xwLoad(s[SAMPLE_P0Y] + b), xwLoad(s[SAMPLE_P1Y] + b), tp);
+		xwide pz = xwLerp(xwLoad(s[SAMPLE_P0Z] + b), xwLoad(s[SAMPLE_P1Z] + b), tp);
+
+		xwide q0w = xwLoad(s[SAMPLE_Q0W] + b), q0x = xwLoad(s[SAMPLE_Q0X] + b), q0y = xwLoad(s[SAMPLE_Q0Y] + b), q0z = xwLoad(s[SAMPLE_Q0Z] + b);
+		xwide q1w = xwLoad(s[SAMPLE_Q1W] + b), q1x = xwLoad(s[SAMPLE_Q1X] + b), q1y = xwLoad(s[SAMPLE_Q1Y] + b), q1z = xwLoad(s[SAMPLE_Q1Z] + b);
+		xwide d = xwMadd(q0w, q1w, xwMadd(q0x, q1x, xwMadd(q0y, q1y, xwMul(q0z, q1z))));
+		q1w = xwFlipSign(q1w, d);           //Shorter arc
+		q1x = xwFlipSign(q1x, d);
+		q1y = xwFlipSign(q1y, d);
+		q1z = xwFlipSign(q1z, d);
+		d = xwAbs(d);
+
+		//Corrected factor: t + t (t - 0.5) (t - 1) k, with k fitted to the angle (via the cosine d)
+		xwide t = xwLoad(s[SAMPLE_TR] + b);
+		xwide A = xwMadd(d, xwMadd(d, xwMadd(d, xwSplat(-1.43519f), xwSplat(3.55645f)), xwSplat(-3.2452f)), xwSplat(1.0904f));
+		xwide B = xwMadd(d, xwMadd(d, xwSplat(0.215638f), xwSplat(-1.06021f)), xwSplat(0.848013f));
+		xwide u = xwSub(t, half);
+		xwide k = xwMadd(xwMul(A, u), u, B);
+		t = xwMadd(xwMul(xwMul(t, u), xwSub(t, one)), k, t);
+
+		xwide w = xwLerp(q0w, q1w, t), x = xwLerp(q0x, q1x, t), y = xwLerp(q0y, q1y, t), z = xwLerp(q0z, q1z, t);
+		xwide inv = xwDiv(one, xwSqrt(xwMadd(w, w, xwMadd(x, x, xwMadd(y, y, xwMul(z, z))))));
+		w = xwMul(w, inv);
+		x = xwMul(x, inv);
+		y = xwMul(y, inv);
+		z = xwMul(z, inv);
+
+		xformStoreFromQuat4(cs->local + b, 4, xwHalf<0>(w), xwHalf<0>(x), xwHalf<0>(y), xwHalf<0>(z),
+			xwHalf<0>(px), xwHalf<0>(py), xwHalf<0>(pz));
+		xformStoreFromQuat4(cs->local + b + 4, 4, xwHalf<1>(w), xwHalf<1>(x), xwHalf<1>(y), xwHalf<1>(z),
+			xwHalf<1>(px), xwHalf<1>(py), xwHalf<1>(pz));
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Samples channels[0 .. n-1] at the time: cs->local[c] is the local transformation
+// of channels[c]. "motion" (may be NULL) is removed from the root channel's position.
+void sampleChannels(channelSampler* cs, const int* channels, int n, double time, const rootMotion* motion)
+{
+	for (int c = 0; c < n; c++) gatherChannel(cs, c, channels[c], time, motion);
+	evaluateSamples(cs, n);
+}
+
+// ----------------------------------------------------------------------------
+// Reference: the original per-channel evaluation, into cs->local as sampleChannels()
+void sampleChannelsScalar(channelSampler* cs, const int* channels, int n, double tick, const rootMotion* motion)
+{
+	const clipInfo* ci = cs->ci;
+	aiMatrix4x4 matPos, matRot;
+	for (int c = 0; c < n; c++)
+	{
+		int i = channels[c];
+		const aiNodeAnim* channel = ci->posnChannel[i];
+		aiVector3D posn;
+		if (ci->constPosn[i]) posn = channel->mPositionKeys[0].mValue;
+		else
+		{
+			for (int k = 0; k < channel->mNumPositionKeys; k++)
+			{
+				if (tick < channel->mPositionKeys[k].mTime)
+				{
+					aiVector3D pos1 = channel->mPositionKeys[k - 1].mValue;
+					aiVector3D pos2 = channel->mPositionKeys[k].mValue;
+					float factor = (tick - channel->mPositionKeys[k - 1].mTime) / (channel->mPositionKeys[k].mTime - channel->mPositionKeys[k - 1].mTime);
+					posn = pos1 + factor * (pos2 - pos1);
+					break;
+				}
+				else if (tick == channel->mPositionKeys[k].mTime)
+				{
+					posn = channel->mPositionKeys[k].mValue;
+					break;
+				}
+			}
+			if (motion != NULL && i == motion->channel) posn = posn - rootMotionLocal(motion, (int)tick);
+		}
+		aiMatrix4x4::Translation(posn, matPos);
+
+		channel = ci->anim->mChannels[i];
+		aiQuaternion rotn;
+		if (ci->constRotn[i]) rotn = channel->mRotationKeys[0].mValue;
+		else
+		{
+			for (int k = 0; k < channel->mNumRotationKeys; k++)
+			{
+				if (tick < channel->mRotationKeys[k].mTime)
+				{
+					float factor = (tick - channel->mRotationKeys[k - 1].mTime) / (channel->mRotationKeys[k].mTime - channel->mRotationKeys[k - 1].mTime);
+					aiQuaternion::Interpolate(rotn, channel->mRotationKeys[k - 1].mValue, channel->mRotationKeys[k].mValue, factor);
+					break;
+				}
+				else if (tick == channel->mRotationKeys[k].mTime)
+				{
+					rotn = channel->mRotationKeys[k].mValue;
+					break;
+				}
+			}
+		}
+		matRot = aiMatrix4x4(rotn.GetMatrix());
+		cs->local[c] = matPos * matRot;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Samples every channel of a clip file on every tick (and at the tick midpoints,
+// where interpolation is exercised), with both paths. Reports channels per second
+// and the largest difference of a matrix element.
+int benchmarkSampler(const char* fileName, int nRepeats = 20)
+{
+	typedef std::chrono::steady_clock clock;
+	const aiScene* sc = aiImportFile(fileName, aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_Debone);
+	if (sc == NULL || !sc->HasAnimations())
+	{
+		cout << "No animation found in " << fileName << endl;
+		return 1;
+	}
+	clipInfo ci;
+	channelSampler cs;
+	assetArena arena;
+	createArena(&arena, fileName);
+	analyseClip(&ci, &arena, sc->mAnimations[0], NULL);
+	buildChannelSampler(&cs, &arena, &ci);
+	int nTimes = 2 * aisgl_max((int)sc->mAnimations[0]->mDuration, 1);
+	aiMatrix4x4* reference = arenaAlloc<aiMatrix4x4>(&arena, ARENA_CLIPS, ci.nChannels);
+	double scalarSeconds = 0, batchSeconds = 0;
+	float error = 0;
+
+	for (int r = 0; r < nRepeats; r++)
+	{
+		for (int f = 0; f < nTimes; f++)
+		{
+			double time = 0.5 * f;
+			clock::time_point start = clock::now();
+			sampleChannelsScalar(&cs, ci.bound, ci.nBound, time, NULL);
+			scalarSeconds += std::chrono::duration<double>(clock::now() - start).count();
+			if (r == 0) memcpy(reference, cs.local, ci.nBound * sizeof(aiMatrix4x4));
+			start = clock::now();
+			sampleChannels(&cs, ci.bound, ci.nBound, time, NULL);
+			batchSeconds += std::chrono::duration<double>(clock::now() - start).count();
+			if (r == 0)
+				for (int c = 0; c < ci.nBound; c++)
+					for (int e = 0; e < 12; e++)
+					{
+						float scale = aisgl_max(1.0f, (float)fabs((&reference[c].a1)[e]));
+						error = aisgl_max(error, (float)fabs((&reference[c].a1)[e] - (&cs.local[c].a1)[e]) / scale);
+					}
+		}
+	}
+	double nSamples = (double)ci.nBound * nTimes * nRepeats;
+	cout << "Sampler (" << fileName << "): " << ci.nBound << " channels, " << nTimes << " times, " << nRepeats << " passes"
+#ifdef __AVX__
+		<< ", AVX" << endl;
+#else
+		<< ", 2 x 4 lanes" << endl;
+#endif
+	cout << "    scalar: " << nSamples / scalarSeconds / 1e6 << " M channels/s" << endl;
+	cout << "    batched: " << nSamples / batchSeconds / 1e6 << " M channels/s (" << scalarSeconds / batchSeconds << "x)" << endl;
+	cout << "    largest difference: " << error << " (matrix element, relative to max(1, |element|))" << endl;
+	releaseArena(&arena);
+	aiReleaseImport(sc);
+	return 0;
+}
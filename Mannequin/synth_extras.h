@@ -0,0 +1,300 @@
+// ----------------------------------------------------------------------------
+// Synthetic model helper functions
+//
+// Generates a skinned model and a matching clip in memory, as a scene the
+// loader takes in place of an imported one. The rig is a set of bone chains
+// (the hierarchy depth) hanging from the root, side by side on a grid; each
+// chain is wrapped in a tube of vertex rings. Every vertex is weighted to its
+// nearest bone and to the bones next to it in the bone order, with falling
+// weights. The clip bends every chain in a travelling wave, with rotation keys
+// spaced evenly over the clip and a constant position key. Vertex count (up to
+// millions), bone count, depth, influences per vertex and keys per channel are
+// set independently, so that each stage can be timed along each axis.
+// The scene is owned by the program as an imported one (aiReleaseImport frees it).
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#define SYNTH_SEGMENTS 8          //Vertices per ring of a tube
+#define SYNTH_RADIUS 0.15f        //Tube radius (bone length 1)
+#define SYNTH_SPACING 0.5f        //Distance between neighbouring chains
+
+struct syntheticSpec
+{
+	int nVertices;                //Requested; rounded to whole rings
+	int nBones;
+	int depth;                    //Bones per chain
+	int nInfluences;              //Bones weighted to each vertex
+	int nKeys;                    //Rotation keys per channel
+	int nTicks;                   //Duration of the clip
+};
+
+// ----------------------------------------------------------------------------
+// Parses "vertices=n,bones=n,depth=n,influences=n,keys=n,ticks=n" (any subset,
+// in any order; the others keep their defaults). Returns false if it is invalid.
+bool parseSyntheticSpec(syntheticSpec* spec, const char* text)
+{
+	spec->nVertices = 10000;
+	spec->nBones = 32;
+	spec->depth = 8;
+	spec->nInfluences = 4;
+	spec->nKeys = 30;
+	spec->nTicks = 100;
+	const char* p = text;
+	while (*p != '\0')
+	{
+		char name[32];
+		int value, length;
+		if (sscanf(p, "%31[^=,]=%d%n", name, &value, &length) != 2)
+		{
+			cout << "Synthetic: cannot read \"" << p << "\"" << endl;
+			return false;
+		}
+		if (strcmp(name, "vertices") == 0) spec->nVertices = value;
+		else if (strcmp(name, "bones") == 0) spec->nBones = value;
+		else if (strcmp(name, "depth") == 0) spec->depth = value;
+		else if (strcmp(name, "influences") == 0) spec->nInfluences = value;
+		else if (strcmp(name, "keys") == 0) spec->nKeys = value;
+		else if (strcmp(name, "ticks") == 0) spec->nTicks = value;
+		else
+		{
+			cout << "Synthetic: unknown parameter " << name << endl;
+			return false;
+		}
+		p += length;
+		if (*p == ',') p++;
+	}
+	int nChains = (spec->nBones + spec->depth - 1) / aisgl_max(spec->depth, 1);
+	bool ok = spec->nBones >= 1 && spec->depth >= 1 && spec->depth <= spec->nBones && spec->nInfluences >= 1
+		&& spec->nInfluences <= spec->nBones && spec->nKeys >= 2 && spec->nTicks >= 1
+		&& spec->nVertices >= 2 * SYNTH_SEGMENTS * nChains;
+	if (!ok) cout << "Synthetic: needs 1 <= depth <= bones, 1 <= influences <= bones, keys >= 2, ticks >= 1 and at least "
+		<< 2 * SYNTH_SEGMENTS << " vertices per chain" << endl;
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+// Builds the scene; the chains grow along "up" (the model's up axis)
+aiScene* buildSyntheticScene(const syntheticSpec* spec, aiVector3D up)
+{
+	int nBones = spec->nBones, depth = spec->depth;
+	int nChains = (nBones + depth - 1) / depth;
+	int gridSize = (int)ceil(sqrt((double)nChains));
+	up.Normalize();
+	aiVector3D a = (fabs(up.x) < 0.9f) ? aiVector3D(1, 0, 0) : aiVector3D(0, 1, 0);   //Axes across the chains
+	a = (a - up * (a * up)).Normalize();
+	aiVector3D b = up ^ a;
+
+	aiScene* sc = new aiScene;
+	sc->mRootNode = new aiNode("synthetic_root");
+	sc->mRootNode->mNumMeshes = 1;
+	sc->mRootNode->mMeshes = new unsigned int[1];
+	sc->mRootNode->mMeshes[0] = 0;
+	sc->mRootNode->mNumChildren = nChains;
+	sc->mRootNode->mChildren = new aiNode*[nChains];
+
+	//Bones: chain c holds bones c * depth .. c * depth + length - 1, parents first
+	aiNode** bones = new aiNode*[nBones];
+	aiVector3D* bind = new aiVector3D[nBones];   //Bind-pose position of each bone
+	for (int i = 0; i < nBones; i++)
+	{
+		int c = i / depth, p = i % depth;
+		char name[32];
+		snprintf(name, sizeof(name), "bone_%d", i);
+		bones[i] = new aiNode(name);
+		aiVector3D base = a * (SYNTH_SPACING * (c % gridSize)) + b * (SYNTH_SPACING * (c / gridSize));
+		bind[i] = base + up * (float)p;
+		aiVector3D local = (p == 0) ? base : up;
+		aiMatrix4x4::Translation(local, bones[i]->mTransformation);
+		aiNode* parent = (p == 0) ? sc->mRootNode : bones[i - 1];
+		bones[i]->mParent = parent;
+		if (p == 0) sc->mRootNode->mChildren[c] = bones[i];
+		else
+		{
+			parent->mNumChildren = 1;
+			parent->mChildren = new aiNode*[1];
+			parent->mChildren[0] = bones[i];
+		}
+	}
+
+	//Mesh: one tube of rings per chain, from the chain's base to its tip
+	int ringsPerChain = aisgl_max(spec->nVertices / (nChains * SYNTH_SEGMENTS), 2);
+	int nVertices = nChains * ringsPerChain * SYNTH_SEGMENTS;
+	int nFaces = nChains * (ringsPerChain - 1) * SYNTH_SEGMENTS * 2;
+	aiMesh* mesh = new aiMesh;
+	mesh->mName = aiString("synthetic");
+	mesh->mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+	mesh->mMaterialIndex = 0;
+	mesh->mNumVertices = nVertices;
+	mesh->mVertices = new aiVector3D[nVertices];
+	mesh->mNormals = new aiVector3D[nVertices];
+	mesh->mNumFaces = nFaces;
+	mesh->mFaces = new aiFace[nFaces];
+	int* primary = new int[nVertices];   //Nearest bone of each vertex
+	int v = 0, f = 0;
+	for (int c = 0; c < nChains; c++)
+	{
+		int first = c * depth, length = aisgl_min(depth, nBones - first);
+		for (int r = 0; r < ringsPerChain; r++)
+		{
+			float height = length * (float)r / (ringsPerChain - 1);
+			int bone = first + aisgl_min((int)height, length - 1);
+			for (int s = 0; s < SYNTH_SEGMENTS; s++, v++)
+			{
+				float angle = 2 * AI_MATH_PI_F * s / SYNTH_SEGMENTS;
+				aiVector3D radial = a * cos(angle) + b * sin(angle);
+				mesh->mVertices[v] = bind[first] + up * height + radial * SYNTH_RADIUS;
+				mesh->mNormals[v] = radial;
+				primary[v] = bone;
+				if (r == ringsPerChain - 1) continue;
+				int v1 = v - s + (s + 1) % SYNTH_SEGMENTS;   //Next vertex around the ring
+				int quad[4] = { v, v1, v1 + SYNTH_SEGMENTS, v + SYNTH_SEGMENTS };
+				for (int t = 0; t < 2; t++, f++)
+				{
+					mesh->mFaces[f].mNumIndices = 3;
+					mesh->mFaces[f].mIndices = new unsigned int[3];
+					mesh->mFaces[f].mIndices[0] = quad[0];
+					mesh->mFaces[f].mIndices[1] = quad[t + 1];
+					mesh->mFaces[f].mIndices[2] = quad[t + 2];
+				}
+			}
+		}
+	}
+
+	//Weights: the nearest bone, then its neighbours in the bone order (+1, -1, +2, ...), weight 1/(k+1), normalised
+	int nInf = spec->nInfluences;
+	int* infBone = new int[nVertices * nInf];
+	float* infWeight = new float[nVertices * nInf];
+	int* count = new int[nBones];
+	for (int j = 0; j < nBones; j++) count[j] = 0;
+	float total = 0;
+	for (int k = 0; k < nInf; k++) total += 1.0f / (k + 1);
+	for (int i = 0; i < nVertices; i++)
+	{
+		int k = 0;
+		for (int step = 0; k < nInf; step++)
+		{
+			int j = primary[i] + ((step % 2 == 1) ? (step + 1) / 2 : -(step / 2));
+			if (j < 0 || j >= nBones) continue;
+			infBone[i * nInf + k] = j;
+			infWeight[i * nInf + k] = 1.0f / (k + 1) / total;
+			count[j]++;
+			k++;
+		}
+	}
+	mesh->mNumBones = nBones;
+	mesh->mBones = new aiBone*[nBones];
+	for (int j = 0; j < nBones; j++)
+	{
+		aiBone* bone = new aiBone;
+		bone->mName = bones[j]->mName;
+		aiMatrix4x4::Translation(-bind[j], bone->mOffsetMatrix);
+		bone->mNumWeights = count[j];
+		bone->mWeights = new aiVertexWeight[count[j]];
+		count[j] = 0;
+		mesh->mBones[j] = bone;
+	}
+	for (int i = 0; i < nVertices * nInf; i++)
+	{
+		aiBone* bone = mesh->mBones[infBone[i]];
+		bone->mWeights[count[infBone[i]]++] = aiVertexWeight(i / nInf, infWeight[i]);
+	}
+	sc->mNumMeshes = 1;
+	sc->mMeshes = new aiMesh*[1];
+	sc->mMeshes[0] = mesh;
+
+	aiMaterial* material = new aiMaterial;
+	aiColor4D colour(0.6f, 0.7f, 0.9f, 1);
+	material->AddProperty(&colour, 1, AI_MATKEY_COLOR_DIFFUSE);
+	sc->mNumMaterials = 1;
+	sc->mMaterials = new aiMaterial*[1];
+	sc->mMaterials[0] = material;
+
+	//Clip: each bone swings about the "a" axis, a wave travelling along the chain
+	aiAnimation* anim = new aiAnimation;
+	anim->mName = aiString("synthetic");
+	anim->mDuration = spec->nTicks;
+	anim->mTicksPerSecond = 25;
+	anim->mNumChannels = nBones;
+	anim->mChannels = new aiNodeAnim*[nBones];
+	float amplitude = 0.6f / depth;
+	for (int j = 0; j < nBones; j++)
+	{
+		aiNodeAnim* channel = new aiNodeAnim;
+		channel->mNodeName = bones[j]->mName;
+		channel->mNumPositionKeys = 1;
+		channel->mPositionKeys = new aiVectorKey[1];
+		channel->mPositionKeys[0] = aiVectorKey(0, aiVector3D(bones[j]->mTransformation.a4,
+			bones[j]->mTransformation.b4, bones[j]->mTransformation.c4));
+		channel->mNumScalingKeys = 1;
+		channel->mScalingKeys = new aiVectorKey[1];
+		channel->mScalingKeys[0] = aiVectorKey(0, aiVector3D(1, 1, 1));
+		channel->mNumRotationKeys = spec->nKeys;
+		channel->mRotationKeys = new aiQuatKey[spec->nKeys];
+		float phase = 2 * AI_MATH_PI_F * (j % depth) / depth;
+		for (int k = 0; k < spec->nKeys; k++)
+		{
+			double time = (double)k * spec->nTicks / (spec->nKeys - 1);
+			float angle = amplitude * sin(2 * AI_MATH_PI_F * (float)(time / spec->nTicks) + phase);
+			channel->mRotationKeys[k] = aiQuatKey(time, aiQuaternion(a, angle));
+		}
+		anim->mChannels[j] = channel;
+	}
+	sc->mNumAnimations = 1;
+	sc->mAnimations = new aiAnimation*[1];
+	sc->mAnimations[0] = anim;
+
+	delete[] bones;
+	delete[] bind;
+	delete[] primary;
+	delete[] infBone;
+	delete[] infWeight;
+	delete[] count;
+	cout << "Synthetic: " << nVertices << " vertices, " << nFaces << " triangles, " << nBones << " bones in " << nChains
+		<< " chains of " << depth << ", " << nInf << " influences per vertex, " << spec->nKeys << " keys per channel over "
+		<< spec->nTicks << " ticks" << endl;
+	return sc;
+}
+
+// ----------------------------------------------------------------------------
+// Appends a row to a CSV file (with a header if the file is new or empty):
+// the model's size along each scaling axis and the median time of each stage
+void writeScalingRow(const char* fileName, const skinnedMesh* skinData, int nMeshes, const skeleton* skel, const aiAnimation* clip,
+	double sampleMs, double hierarchyMs, double skinMs)
+{
+	long nVertices = 0, nWeights = 0;
+	int nBones = 0;
+	for (int i = 0; i < nMeshes; i++)     //From the influence tables: the scene's weights are released at load
+	{
+		const skinnedMesh* sm = &skinData[i];
+		nVertices += sm->mesh->mNumVertices;
+		nBones += sm->nBones;
+		nWeights += sm->infStart[sm->mesh->mNumVertices];
+	}
+	int depth = 0;
+	for (int i = 0; i < skel->nNodes; i++)
+	{
+		int d = 0;
+		for (int p = skel->parent[i]; p >= 0; p = skel->parent[p]) d++;
+		depth = aisgl_max(depth, d);
+	}
+	long nKeys = 0;
+	for (int i = 0; i < clip->mNumChannels; i++) nKeys += clip->mChannels[i]->mNumRotationKeys;
+
+	FILE* fp = fopen(fileName, "a");
+	if (fp == NULL)
+	{
+		cout << "Scaling: could not open " << fileName << endl;
+		return;
+	}
+	fseek(fp, 0, SEEK_END);
+	if (ftell(fp) == 0) fprintf(fp, "vertices,bones,nodes,depth,influences,keys,sample_ms,hierarchy_ms,skin_ms\n");
+	fprintf(fp, "%ld,%d,%d,%d,%.2f,%.1f,%.4f,%.4f,%.4f\n", nVertices, nBones, skel->nNodes, depth,
+		nVertices > 0 ? (double)nWeights / nVertices : 0, clip->mNumChannels > 0 ? (double)nKeys / clip->mNumChannels : 0,
+		sampleMs, hierarchyMs, skinMs);
+	fclose(fp);
+	cout << "Scaling: " << nVertices << " vertices, " << skel->nNodes << " nodes (depth " << depth << "): sample "
+		<< sampleMs << " ms, hierarchy " << hierarchyMs << " ms, skin " << skinMs << " ms per tick, appended to " << fileName << endl;
+}
@@ -0,0 +1,157 @@
+// ----------------------------------------------------------------------------
+// Timeline trace helper functions
+//
+// Spans bracketed with beginTrace() / endTrace() are recorded as complete events
+// into a buffer owned by the calling thread (created on its first event), so
+// recording takes no lock: a thread only appends to its own buffer and publishes
+// the new count with a release store. At exit the buffers are written in the
+// Chrome trace event format (JSON), which chrome://tracing and Perfetto open,
+// one track per thread. When tracing is off, beginTrace() is a single relaxed
+// atomic load. Span names must be string literals (only the pointer is kept).
+//-----------------------------------------------------------------------------
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#define TRACE_MAX_THREADS 16
+#define TRACE_BUFFER_EVENTS 262144   //Per thread; further events are dropped and counted
+
+struct traceEvent
+{
+	const char* name;
+	long long start, duration;    //Nanoseconds since the trace started
+};
+
+struct traceBuffer
+{
+	const char* threadName;
+	int tid;
+	std::atomic<int> nEvents;     //Events published by the owning thread
+	long nDropped;
+	traceEvent* events;
+};
+
+struct traceMark
+{
+	const char* name;
+	long long start;              //-1: not traced
+};
+
+struct traceRecorder
+{
+	std::atomic<bool> enabled;
+	const char* fileName;
+	long long origin;
+	std::atomic<int> nBuffers;
+	std::atomic<traceBuffer*> buffers[TRACE_MAX_THREADS];
+};
+
+traceRecorder tracer;
+thread_local traceBuffer* traceLocal = NULL;
+
+long long traceNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ----------------------------------------------------------------------------
+// Buffer of the calling thread (NULL if there are already TRACE_MAX_THREADS)
+traceBuffer* traceThreadBuffer()
+{
+	if (traceLocal != NULL) return traceLocal;
+	int index = tracer.nBuffers.fetch_add(1);
+	if (index >= TRACE_MAX_THREADS) return NULL;
+	traceBuffer* b = new traceBuffer;
+	b->threadName = NULL;
+	b->tid = index + 1;
+	b->nEvents = 0;
+	b->nDropped = 0;
+	b->events = new traceEvent[TRACE_BUFFER_EVENTS];
+	tracer.buffers[index] = b;
+	traceLocal = b;
+	return b;
+}
+
+// ----------------------------------------------------------------------------
+void nameTraceThread(const char* name)
+{
+	if (!tracer.enabled.load(std::memory_order_relaxed)) return;
+	traceBuffer* b = traceThreadBuffer();
+	if (b != NULL) b->threadName = name;
+}
+
+traceMark beginTrace(const char* name)
+{
+	traceMark m = { name, -1 };
+	if (tracer.enabled.load(std::memory_order_relaxed)) m.start = traceNow();
+	return m;
+}
+
+void endTrace(traceMark m)
+{
+	if (m.start < 0) return;
+	long long end = traceNow();
+	traceBuffer* b = traceThreadBuffer();
+	if (b == NULL) return;
+	int n = b->nEvents.load(std::memory_order_relaxed);
+	if (n >= TRACE_BUFFER_EVENTS)
+	{
+		b->nDropped++;
+		return;
+	}
+	traceEvent* e = &b->events[n];
+	e->name = m.name;
+	e->start = m.start - tracer.origin;
+	e->duration = end - m.start;
+	b->nEvents.store(n + 1, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+// Writes the events recorded so far (called at exit once tracing has started)
+void writeTrace()
+{
+	if (!tracer.enabled) return;
+	tracer.enabled = false;
+	FILE* fp = fopen(tracer.fileName, "w");
+	if (fp == NULL)
+	{
+		cout << "Trace: could not open " << tracer.fileName << endl;
+		return;
+	}
+	int nThreads = aisgl_min(tracer.nBuffers.load(), TRACE_MAX_THREADS);
+	long nEvents = 0, nDropped = 0;
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	for (int t = 0; t < nThreads; t++)
+	{
+		traceBuffer* b = tracer.buffers[t];
+		if (b == NULL) continue;
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			first ? "" : ",\n", b->tid, b->threadName != NULL ? b->threadName : "thread");
+		first = false;
+		int n = b->nEvents.load(std::memory_order_acquire);
+		for (int i = 0; i < n; i++)
+			fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", b->events[i].name,
+				b->tid, 1e-3 * b->events[i].start, 1e-3 * b->events[i].duration);
+		nEvents += n;
+		nDropped += b->nDropped;
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	cout << "Trace: " << nEvents << " events from " << nThreads << " threads written to " << tracer.fileName;
+	if (nDropped > 0) cout << " (" << nDropped << " dropped)";
+	cout << endl;
+}
+
+// ----------------------------------------------------------------------------
+// Starts recording; the trace is written when the program exits
+void startTrace(const char* fileName)
+{
+	tracer.fileName = fileName;
+	tracer.origin = traceNow();
+	tracer.enabled = true;
+	nameTraceThread("main");
+	atexit(writeTrace);
+}